@@ -0,0 +1,213 @@
+#include "aes_ctr.h"
+#include "aes_fifo.h"
+
+#include <nds.h>
+
+#define AES_WRFIFO_COUNT() (REG_AES_CNT & 0x1F)
+#define AES_RDFIFO_COUNT() ((REG_AES_CNT >> 0x5) & 0x1F)
+#define AES_FIFO_WORDS 16
+
+// ccm bits of REG_AES_CNT, see gbatek "DSi AES I/O Ports"
+#define AES_CCM_MAC_SIZE(bytes) ((((bytes) - 2) / 2) << 16)
+#define AES_CCM_MAC_VERIFIED (1 << 21)
+#define AES_ES_NORMALKEY ((vu32*)(0x04004440 + AES_ES_KEYSLOT * 0x30))
+
+#define AES_BLOCKS_PER_SECTOR (512 / 16)
+
+// counter of nand sector 0, sent by the arm9 once it verified the engine
+static u32 nandCtr[4];
+static bool nandCtrSet = false;
+
+//---------------------------------------------------------------------------------
+void aes_ctr_keyslot(u32 keyslot, const u32 ctr[4], const u32* in, u32* out, u32 blocks)
+//---------------------------------------------------------------------------------
+{
+	REG_AES_CNT = ( AES_CNT_MODE(2) |
+					AES_WRFIFO_FLUSH |
+					AES_RDFIFO_FLUSH |
+					AES_CNT_KEY_APPLY |
+					AES_CNT_KEYSLOT(keyslot) |
+					AES_CNT_DMA_WRITE_SIZE(2) |
+					AES_CNT_DMA_READ_SIZE(1)
+					);
+
+	for (int i = 0; i < 4; i++) REG_AES_IV[i] = ctr[i];
+	REG_AES_BLKCNT = (blocks << 16);
+	REG_AES_CNT |= 0x80000000;
+
+	// keep both fifos busy, the engine only produces output while the input side is fed
+	u32 toWrite = blocks * 4;
+	u32 toRead = blocks * 4;
+	while (toRead > 0)
+	{
+		while (toWrite > 0 && AES_WRFIFO_COUNT() < AES_FIFO_WORDS)
+		{
+			REG_AES_WRFIFO = *in++;
+			toWrite--;
+		}
+		while (toRead > 0 && AES_RDFIFO_COUNT() > 0)
+		{
+			*out++ = REG_AES_RDFIFO;
+			toRead--;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------
+int aes_nand_crypt_sectors(u32 sector, u32 count, const u32* in, u32* out)
+//---------------------------------------------------------------------------------
+{
+	if (!nandCtrSet)
+		return -1;
+
+	u32 ctr[4];
+	for (int i = 0; i < 4; i++) ctr[i] = nandCtr[i];
+	// sector * 32 fits easily, the nand is far smaller than 64GB
+	u32 add = sector * AES_BLOCKS_PER_SECTOR;
+	for (int i = 0; i < 4; i++)
+	{
+		ctr[i] += add;
+		add = ctr[i] < add;
+	}
+
+	u32 blocks = count * AES_BLOCKS_PER_SECTOR;
+	while (blocks > 0)
+	{
+		// whole sectors per run, so the counter only ever moves by full sectors
+		u32 run = blocks > AES_FIFO_MAX_BLOCKS ? AES_FIFO_MAX_BLOCKS - AES_FIFO_MAX_BLOCKS % AES_BLOCKS_PER_SECTOR : blocks;
+		aes_ctr_keyslot(3, ctr, in, out, run);
+		in += run * 4;
+		out += run * 4;
+		blocks -= run;
+		add = run;
+		for (int i = 0; i < 4; i++)
+		{
+			ctr[i] += add;
+			add = ctr[i] < add;
+		}
+	}
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+static void aes_set_es_key(const u32 key[4])
+//---------------------------------------------------------------------------------
+{
+	for (int i = 0; i < 4; i++) AES_ES_NORMALKEY[i] = key[i];
+}
+
+//---------------------------------------------------------------------------------
+// ccm with a 16 byte mac in the keyslot holding the es key. encrypting writes
+// the mac to mac, decrypting checks the one in mac and returns 0 if it matched
+static int aes_ccm_es(bool encrypt, const u32 nonce[3], const u32* in, u32* out, u32 blocks, u32* mac)
+//---------------------------------------------------------------------------------
+{
+	REG_AES_CNT = ( AES_CNT_MODE(encrypt ? 1 : 0) |
+					AES_WRFIFO_FLUSH |
+					AES_RDFIFO_FLUSH |
+					AES_CNT_KEY_APPLY |
+					AES_CNT_KEYSLOT(AES_ES_KEYSLOT) |
+					AES_CCM_MAC_SIZE(16) |
+					AES_CNT_DMA_WRITE_SIZE(2) |
+					AES_CNT_DMA_READ_SIZE(1)
+					);
+
+	for (int i = 0; i < 3; i++) REG_AES_IV[i] = nonce[i];
+	if (!encrypt)
+		for (int i = 0; i < 4; i++) REG_AES_MAC[i] = mac[i];
+	REG_AES_BLKCNT = (blocks << 16);
+	REG_AES_CNT |= 0x80000000;
+
+	// the encrypted mac comes out of the read fifo after the payload
+	u32 toWrite = blocks * 4;
+	u32 toRead = blocks * 4 + (encrypt ? 4 : 0);
+	while (toRead > 0)
+	{
+		while (toWrite > 0 && AES_WRFIFO_COUNT() < AES_FIFO_WORDS)
+		{
+			REG_AES_WRFIFO = *in++;
+			toWrite--;
+		}
+		while (toRead > 0 && AES_RDFIFO_COUNT() > 0)
+		{
+			if (encrypt && toRead == 4)
+				out = mac;
+			*out++ = REG_AES_RDFIFO;
+			toRead--;
+		}
+	}
+
+	if (encrypt)
+		return 0;
+
+	while (REG_AES_CNT & AES_CNT_ENABLE);
+	return (REG_AES_CNT & AES_CCM_MAC_VERIFIED) ? 0 : -1;
+}
+
+// the arm9 waits for the reply to each request, so there's never more than
+// one waiting for aes_run_pending
+static AesFifoMessage pendingMsg;
+static volatile bool msgPending = false;
+
+//---------------------------------------------------------------------------------
+static void aesMsgHandler(int bytes, void *user_data)
+//---------------------------------------------------------------------------------
+{
+	fifoGetDatamsg(FIFO_AES, bytes, (u8*)&pendingMsg);
+	msgPending = true;
+}
+
+//---------------------------------------------------------------------------------
+bool aes_run_pending()
+//---------------------------------------------------------------------------------
+{
+	if (!msgPending)
+		return false;
+	AesFifoMessage msg = pendingMsg;
+	msgPending = false;
+
+	int retval = 0;
+	switch (msg.command)
+	{
+		case AES_FIFO_NAND_CTR:
+			if (msg.blocks > AES_FIFO_MAX_BLOCKS)
+			{
+				retval = -1;
+				break;
+			}
+			aes_ctr_keyslot(3, msg.iv, (const u32*)msg.in, (u32*)msg.out, msg.blocks);
+			break;
+		case AES_FIFO_ES_SET_KEY:
+			aes_set_es_key(msg.iv);
+			break;
+		case AES_FIFO_NAND_SET_CTR:
+			for (int i = 0; i < 4; i++) nandCtr[i] = msg.iv[i];
+			nandCtrSet = true;
+			break;
+		case AES_FIFO_ES_CCM_ENCRYPT:
+		case AES_FIFO_ES_CCM_DECRYPT:
+		{
+			if (msg.blocks > AES_FIFO_MAX_BLOCKS)
+			{
+				retval = -1;
+				break;
+			}
+			bool encrypt = msg.command == AES_FIFO_ES_CCM_ENCRYPT;
+			retval = aes_ccm_es(encrypt, msg.iv, (const u32*)msg.in, (u32*)msg.out, msg.blocks, (u32*)msg.mac);
+			break;
+		}
+		default:
+			retval = -1;
+			break;
+	}
+
+	fifoSendValue32(FIFO_AES, retval);
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+void installAesFIFO()
+//---------------------------------------------------------------------------------
+{
+	fifoSetDatamsgHandler(FIFO_AES, aesMsgHandler, 0);
+}
@@ -0,0 +1,26 @@
+#ifndef AES_CTR_H
+#define AES_CTR_H
+
+#include <nds/ndstypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// runs the AES engine in ctr mode over whole blocks, in and out can overlap
+void aes_ctr_keyslot(u32 keyslot, const u32 ctr[4], const u32* in, u32* out, u32 blocks);
+
+// nand crypt of whole sectors with the counter from AES_FIFO_NAND_SET_CTR,
+// returns -1 while the arm9 hasn't sent one yet
+int aes_nand_crypt_sectors(u32 sector, u32 count, const u32* in, u32* out);
+
+void installAesFIFO();
+// the fifo handler only stores a request, this runs it from the main loop
+// with interrupts on and sends the reply. false if nothing was waiting
+bool aes_run_pending();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
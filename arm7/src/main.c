@@ -28,16 +28,20 @@
 
 ---------------------------------------------------------------------------------*/
 #include "my_sdmmc.h"
+#include "aes_ctr.h"
 
 #include "deviceList.h"
 #include <nds.h>
 #include <string.h>
 
+static volatile u32 frameCount = 0;
+
 //---------------------------------------------------------------------------------
 void VcountHandler()
 //---------------------------------------------------------------------------------
 {
 	inputGetAndSend();
+	frameCount++;
 }
 
 volatile bool exitflag = false;
@@ -177,26 +181,47 @@ int main()
 
 	installSystemFIFO();
 
+	if (isDSiMode())
+	{
+		installSdmmcQueueFIFO();
+		installAesFIFO();
+	}
+
 	irqSet(IRQ_VCOUNT, VcountHandler);
 
 	irqEnable( IRQ_VBLANK | IRQ_VCOUNT | IRQ_NETWORK);
 
 	// Keep the ARM7 mostly idle
 	int oldBatteryStatus = 0;
+	u32 lastFrame = frameCount - 1;
 	while (!exitflag)
 	{
-		if ( 0 == (REG_KEYINPUT & (KEY_SELECT | KEY_START | KEY_L | KEY_R)))
+		// the fifo handlers only take note of nand and aes requests, they're
+		// carried out here so vblank and input keep going during long transfers
+		if (isDSiMode())
 		{
-			exitflag = true;
+			my_sdmmc_run_queue();
+			aes_run_pending();
 		}
 
-		int batteryStatus = i2cReadRegister(I2C_PM, I2CREGPM_BATTERY);
-		if(oldBatteryStatus != batteryStatus)
+		// once a frame, however often requests wake us up
+		if (lastFrame != frameCount)
 		{
-			fifoSendValue32(FIFO_USER_03, oldBatteryStatus = batteryStatus);
+			lastFrame = frameCount;
+			if ( 0 == (REG_KEYINPUT & (KEY_SELECT | KEY_START | KEY_L | KEY_R)))
+			{
+				exitflag = true;
+			}
+
+			int batteryStatus = i2cReadRegister(I2C_PM, I2CREGPM_BATTERY);
+			if(oldBatteryStatus != batteryStatus)
+			{
+				fifoSendValue32(FIFO_USER_03, oldBatteryStatus = batteryStatus);
+			}
 		}
 
-		swiWaitForVBlank();
+		// returns straight away if a request came in while we were busy
+		swiIntrWait(0, IRQ_VBLANK | IRQ_FIFO_NOT_EMPTY);
 	}
 
 	// Tell ARM9 to safely exit
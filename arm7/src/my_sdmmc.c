@@ -1,15 +1,39 @@
 #include <nds/system.h>
 #include <nds/bios.h>
 #include "my_sdmmc.h"
+#include "sdmmc_queue.h"
+#include "aes_ctr.h"
 #include <nds/interrupts.h>
 #include <nds/fifocommon.h>
 #include <nds/fifomessages.h>
+#include <nds/timers.h>
 
 #include <stddef.h>
 
 static struct mmcdevice deviceSD;
 static struct mmcdevice deviceNAND;
 
+#ifdef NAND_PROFILE
+static SdmmcProfile *sdmmcProfile = NULL;
+#endif
+
+// the block count registers are 16 bit
+#define MY_SDMMC_MAX_BLOCKS 0xFFFF
+
+#ifdef DATA32_SUPPORT
+// one multi block read spread over consecutive queue entries, send_command
+// moves the NDMA on to the next entry's buffer whenever one is full
+typedef struct SdmmcStream {
+	SdmmcQueue *queue;
+	u32 first; // ring position of the first entry
+	u32 count;
+	u32 done; // entries whose data has fully arrived
+	bool decrypt;
+} SdmmcStream;
+
+static SdmmcStream *activeStream = NULL;
+#endif
+
 /*mmcdevice *getMMCDevice(int drive)
 {
 	if (drive==0) return &deviceNAND;
@@ -45,8 +69,72 @@ void my_setTarget(struct mmcdevice *ctx)
 }
 
 
+#ifdef DATA32_SUPPORT
 //---------------------------------------------------------------------------------
-void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
+static bool my_sdmmc_dma_usable(const void *buffer, u32 size, u16 blkSize)
+//---------------------------------------------------------------------------------
+{
+	u32 addr = (u32)buffer;
+	// main ram or wram, word aligned, whole blocks only
+	return buffer != NULL && size != 0 && blkSize == 0x200 && (size % blkSize) == 0
+		&& (addr & 3) == 0 && ((addr >> 24) == 0x02 || (addr >> 24) == 0x03);
+}
+
+//---------------------------------------------------------------------------------
+static void my_sdmmc_dma_start(bool read, const void *buffer, u32 size, u16 blkSize)
+//---------------------------------------------------------------------------------
+{
+	const u32 ch = MY_SDMMC_NDMA_CHANNEL;
+	const u32 fifo = SDMMC_BASE + REG_SDFIFO32;
+
+	REG_NDMA_CNT(ch) = 0;
+	REG_NDMA_SAD(ch) = read ? fifo : (u32)buffer;
+	REG_NDMA_DAD(ch) = read ? (u32)buffer : fifo;
+	REG_NDMA_TCNT(ch) = size / 4;
+	// one controller request per block
+	REG_NDMA_WCNT(ch) = blkSize / 4;
+	REG_NDMA_BCNT(ch) = 0;
+	REG_NDMA_CNT(ch) = NDMA_ENABLE | NDMA_START_SDMMC | NDMA_BLOCK_WORDS(7)
+		| (read ? NDMA_SRC_FIX : NDMA_DST_FIX);
+}
+
+//---------------------------------------------------------------------------------
+static SdmmcQueueEntry *my_sdmmc_stream_entry(SdmmcStream *stream, u32 i)
+//---------------------------------------------------------------------------------
+{
+	return &stream->queue->entries[(stream->first + i) % SDMMC_QUEUE_LEN];
+}
+
+//---------------------------------------------------------------------------------
+// hands the entry whose segment just completed back to the arm9, the card
+// keeps streaming into the next one meanwhile
+static void my_sdmmc_stream_poll(SdmmcStream *stream)
+//---------------------------------------------------------------------------------
+{
+	if (stream->done >= stream->count || (REG_NDMA_CNT(MY_SDMMC_NDMA_CHANNEL) & NDMA_ENABLE))
+		return;
+	// a crc error on the last block of the segment shows up here
+	if (sdmmc_read16(REG_SDSTATUS1) & TMIO_MASK_GW)
+		return;
+
+	SdmmcQueueEntry *entry = my_sdmmc_stream_entry(stream, stream->done);
+	stream->done++;
+	if (stream->done < stream->count)
+	{
+		SdmmcQueueEntry *next = my_sdmmc_stream_entry(stream, stream->done);
+		my_sdmmc_dma_start(true, next->buffer, next->count << 9, 0x200);
+	}
+
+	int retval = 0;
+	if (stream->decrypt)
+		retval = aes_nand_crypt_sectors(entry->start, entry->count, (const u32*)entry->buffer, (u32*)entry->buffer);
+	stream->queue->next++;
+	entry->status = retval == 0 ? SDMMC_QUEUE_DONE : SDMMC_QUEUE_FAILED;
+}
+#endif
+
+//---------------------------------------------------------------------------------
+static void send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
 //---------------------------------------------------------------------------------
 {
 	const bool getSDRESP = (cmd << 15) >> 31;
@@ -61,17 +149,38 @@ void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
 
 	ctx->error = 0;
 	while ((sdmmc_read16(REG_SDSTATUS1) & TMIO_STAT1_CMD_BUSY)); //mmc working?
+	// only setting up the command is kept from interrupts, the transfer itself
+	// runs with them on
+	int oldIME = enterCriticalSection();
 	sdmmc_write16(REG_SDIRMASK0,0);
 	sdmmc_write16(REG_SDIRMASK1,0);
 	sdmmc_write16(REG_SDSTATUS0,0);
 	sdmmc_write16(REG_SDSTATUS1,0);
 	sdmmc_mask16(REG_SDDATACTL32,0x1800,0x400); // Disable TX32RQ and RX32RDY IRQ. Clear fifo.
-	sdmmc_write16(REG_SDCMDARG0,args &0xFFFF);
-	sdmmc_write16(REG_SDCMDARG1,args >> 16);
-	sdmmc_write16(REG_SDCMD,cmd &0xFFFF);
 
 	u32 size = ctx->size;
 	const u16 blkSize = sdmmc_read16(REG_SDBLKLEN32);
+
+	bool useDma = false;
+#ifdef DATA32_SUPPORT
+	if (readdata || writedata)
+	{
+		useDma = my_sdmmc_dma_usable(readdata ? (const void*)ctx->rData : (const void*)ctx->tData, size, blkSize);
+	}
+	if (useDma)
+	{
+		// a stream only gets as far as its first entry's buffer to begin with
+		u32 dmaSize = activeStream ? my_sdmmc_stream_entry(activeStream, 0)->count << 9 : size;
+		my_sdmmc_dma_start(readdata, readdata ? (const void*)ctx->rData : (const void*)ctx->tData, dmaSize, blkSize);
+		// the RX32RDY / TX32RQ irq lines are what trigger the NDMA
+		sdmmc_mask16(REG_SDDATACTL32, 0, readdata ? 0x800 : 0x1000);
+	}
+#endif
+
+	sdmmc_write16(REG_SDCMDARG0,args &0xFFFF);
+	sdmmc_write16(REG_SDCMDARG1,args >> 16);
+	sdmmc_write16(REG_SDCMD,cmd &0xFFFF);
+	leaveCriticalSection(oldIME);
 #ifdef DATA32_SUPPORT
 	u32 *rDataPtr32 = (u32*)ctx->rData;
 #else
@@ -99,7 +208,13 @@ void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
 		volatile u16 status1 = sdmmc_read16(REG_SDSTATUS1);
 #ifdef DATA32_SUPPORT
 		volatile u16 ctl32 = sdmmc_read16(REG_SDDATACTL32);
-		if (ctl32 & 0x100)
+		if (useDma)
+		{
+			// nothing to copy by hand
+			if (activeStream)
+				my_sdmmc_stream_poll(activeStream);
+		}
+		else if (ctl32 & 0x100)
 #else
 		if (status1 & TMIO_STAT1_RXRDY)
 #endif
@@ -156,7 +271,7 @@ void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
 			}
 		}
 #ifdef DATA32_SUPPORT
-		if (!(ctl32 & 0x200))
+		if (!useDma && !(ctl32 & 0x200))
 #else
 		if ((status1 & TMIO_STAT1_TXRQ))
 #endif
@@ -234,6 +349,19 @@ void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
 				break;
 		}
 	}
+
+#ifdef DATA32_SUPPORT
+	if (useDma)
+	{
+		// a failed transfer leaves the channel waiting for requests that won't come
+		if (ctx->error & 4)
+		{
+			REG_NDMA_CNT(MY_SDMMC_NDMA_CHANNEL) = 0;
+		}
+		while (REG_NDMA_CNT(MY_SDMMC_NDMA_CHANNEL) & NDMA_ENABLE);
+		sdmmc_mask16(REG_SDDATACTL32, 0x1800, 0);
+	}
+#endif
 	ctx->stat0 = sdmmc_read16(REG_SDSTATUS0);
 	ctx->stat1 = sdmmc_read16(REG_SDSTATUS1);
 	sdmmc_write16(REG_SDSTATUS0,0);
@@ -248,6 +376,26 @@ void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
 	}
 }
 
+//---------------------------------------------------------------------------------
+void my_sdmmc_send_command(struct mmcdevice *ctx, uint32_t cmd, uint32_t args)
+//---------------------------------------------------------------------------------
+{
+#ifdef NAND_PROFILE
+	u32 bytes = (cmd & 0x60000) ? ctx->size : 0;
+	u32 start = cpuGetTiming();
+	send_command(ctx, cmd, args);
+	if (sdmmcProfile)
+	{
+		sdmmcProfile->ticks += cpuGetTiming() - start;
+		sdmmcProfile->calls++;
+		sdmmcProfile->bytes += bytes;
+		sdmmcProfile->sectors += bytes / 512;
+	}
+#else
+	send_command(ctx, cmd, args);
+#endif
+}
+
 
 //---------------------------------------------------------------------------------
 int my_sdmmc_cardinserted()
@@ -502,7 +650,7 @@ int my_sdmmc_nand_init()
 }
 
 //---------------------------------------------------------------------------------
-int my_sdmmc_readsectors(struct mmcdevice *device, u32 sector_no, u32 numsectors, void *out)
+static int my_sdmmc_readsectors_once(struct mmcdevice *device, u32 sector_no, u32 numsectors, void *out)
 //---------------------------------------------------------------------------------
 {
 	if (device->isSDHC == 0) sector_no <<= 9;
@@ -523,7 +671,7 @@ int my_sdmmc_readsectors(struct mmcdevice *device, u32 sector_no, u32 numsectors
 }
 
 //---------------------------------------------------------------------------------
-int my_sdmmc_writesectors(struct mmcdevice *device, u32 sector_no, u32 numsectors, void *in)
+static int my_sdmmc_writesectors_once(struct mmcdevice *device, u32 sector_no, u32 numsectors, const void *in)
 //---------------------------------------------------------------------------------
 {
 	if (device->isSDHC == 0)
@@ -544,6 +692,38 @@ int my_sdmmc_writesectors(struct mmcdevice *device, u32 sector_no, u32 numsector
 	return my_geterror(device);
 }
 
+//---------------------------------------------------------------------------------
+int my_sdmmc_readsectors(struct mmcdevice *device, u32 sector_no, u32 numsectors, void *out)
+//---------------------------------------------------------------------------------
+{
+	int retval = 0;
+	while (numsectors > 0 && retval == 0)
+	{
+		u32 blocks = numsectors > MY_SDMMC_MAX_BLOCKS ? MY_SDMMC_MAX_BLOCKS : numsectors;
+		retval = my_sdmmc_readsectors_once(device, sector_no, blocks, out);
+		sector_no += blocks;
+		numsectors -= blocks;
+		out = (u8*)out + (blocks << 9);
+	}
+	return retval;
+}
+
+//---------------------------------------------------------------------------------
+int my_sdmmc_writesectors(struct mmcdevice *device, u32 sector_no, u32 numsectors, void *in)
+//---------------------------------------------------------------------------------
+{
+	int retval = 0;
+	while (numsectors > 0 && retval == 0)
+	{
+		u32 blocks = numsectors > MY_SDMMC_MAX_BLOCKS ? MY_SDMMC_MAX_BLOCKS : numsectors;
+		retval = my_sdmmc_writesectors_once(device, sector_no, blocks, in);
+		sector_no += blocks;
+		numsectors -= blocks;
+		in = (u8*)in + (blocks << 9);
+	}
+	return retval;
+}
+
 //---------------------------------------------------------------------------------
 void my_sdmmc_get_cid(int devicenumber, u32 *cid)
 //---------------------------------------------------------------------------------
@@ -573,6 +753,27 @@ void my_sdmmc_get_cid(int devicenumber, u32 *cid)
 	leaveCriticalSection(oldIME);
 }
 
+//---------------------------------------------------------------------------------
+// the sector data never leaves main ram encrypted, the arm9 only sees plaintext
+static int my_sdmmc_nand_decrypt_readsectors(u32 sector_no, u32 numsectors, void *out)
+//---------------------------------------------------------------------------------
+{
+	int retval = my_sdmmc_readsectors(&deviceNAND, sector_no, numsectors, out);
+	if (retval == 0)
+		retval = aes_nand_crypt_sectors(sector_no, numsectors, (const u32*)out, (u32*)out);
+	return retval;
+}
+
+//---------------------------------------------------------------------------------
+static int my_sdmmc_nand_encrypt_writesectors(u32 sector_no, u32 numsectors, void *in)
+//---------------------------------------------------------------------------------
+{
+	int retval = aes_nand_crypt_sectors(sector_no, numsectors, (const u32*)in, (u32*)in);
+	if (retval == 0)
+		retval = my_sdmmc_writesectors(&deviceNAND, sector_no, numsectors, in);
+	return retval;
+}
+
 //---------------------------------------------------------------------------------
 void my_sdmmcMsgHandler(int bytes, void *user_data)
 //---------------------------------------------------------------------------------
@@ -665,6 +866,135 @@ void my_sdmmcValueHandler(u32 value, void* user_data)
 	fifoSendValue32(FIFO_SDMMC, result);
 }
 
+#ifdef DATA32_SUPPORT
+//---------------------------------------------------------------------------------
+// back to back reads of consecutive sectors become a single CMD18 instead of
+// one command each, returns false if there's nothing to merge
+static bool my_sdmmc_stream_reads(SdmmcQueue *queue)
+//---------------------------------------------------------------------------------
+{
+	SdmmcStream stream = { queue, queue->next, 0, 0, false };
+	SdmmcQueueEntry *first = my_sdmmc_stream_entry(&stream, 0);
+	if (first->op != SDMMC_QUEUE_NAND_READ && first->op != SDMMC_QUEUE_NAND_DECRYPT_READ)
+		return false;
+	stream.decrypt = first->op == SDMMC_QUEUE_NAND_DECRYPT_READ;
+
+	u32 sectors = 0;
+	while (stream.count < SDMMC_QUEUE_LEN)
+	{
+		SdmmcQueueEntry *entry = my_sdmmc_stream_entry(&stream, stream.count);
+		if (entry->status != SDMMC_QUEUE_PENDING || entry->op != first->op
+			|| entry->start != first->start + sectors
+			|| sectors + entry->count > MY_SDMMC_MAX_BLOCKS
+			|| !my_sdmmc_dma_usable(entry->buffer, entry->count << 9, 0x200))
+			break;
+		sectors += entry->count;
+		stream.count++;
+	}
+	if (stream.count < 2)
+		return false;
+
+	activeStream = &stream;
+	int retval = my_sdmmc_readsectors_once(&deviceNAND, first->start, sectors, first->buffer);
+	activeStream = NULL;
+	if (retval == 0)
+	{
+		// the last segment is only collected once the command is over
+		while (stream.done < stream.count)
+			my_sdmmc_stream_poll(&stream);
+	}
+
+	// whatever didn't make it is tried again on its own
+	for (u32 i = stream.done; i < stream.count; i++)
+	{
+		SdmmcQueueEntry *entry = my_sdmmc_stream_entry(&stream, i);
+		retval = stream.decrypt
+			? my_sdmmc_nand_decrypt_readsectors(entry->start, entry->count, entry->buffer)
+			: my_sdmmc_readsectors(&deviceNAND, entry->start, entry->count, entry->buffer);
+		queue->next++;
+		entry->status = retval == 0 ? SDMMC_QUEUE_DONE : SDMMC_QUEUE_FAILED;
+	}
+	return true;
+}
+#endif
+
+// the ring the arm9 last kicked, set from the fifo irq and cleared by
+// my_sdmmc_run_queue before it looks at the entries
+static SdmmcQueue *volatile pendingQueue = NULL;
+
+//---------------------------------------------------------------------------------
+static void my_sdmmcQueueHandler(void *address, void *user_data)
+//---------------------------------------------------------------------------------
+{
+	pendingQueue = (SdmmcQueue*)address;
+}
+
+//---------------------------------------------------------------------------------
+bool my_sdmmc_run_queue()
+//---------------------------------------------------------------------------------
+{
+	SdmmcQueue *queue = pendingQueue;
+	if (queue == NULL)
+		return false;
+	pendingQueue = NULL;
+
+	// work through everything queued so far back to back, requests added
+	// meanwhile are picked up as well
+	while (1)
+	{
+		SdmmcQueueEntry *entry = &queue->entries[queue->next % SDMMC_QUEUE_LEN];
+		if (entry->status != SDMMC_QUEUE_PENDING)
+			break;
+#ifdef DATA32_SUPPORT
+		if (my_sdmmc_stream_reads(queue))
+			continue;
+#endif
+
+		int retval = -1;
+		switch (entry->op)
+		{
+			case SDMMC_QUEUE_NAND_READ:
+				retval = my_sdmmc_readsectors(&deviceNAND, entry->start, entry->count, entry->buffer);
+				break;
+			case SDMMC_QUEUE_NAND_WRITE:
+				retval = my_sdmmc_writesectors(&deviceNAND, entry->start, entry->count, entry->buffer);
+				break;
+			case SDMMC_QUEUE_NAND_DECRYPT_READ:
+				retval = my_sdmmc_nand_decrypt_readsectors(entry->start, entry->count, entry->buffer);
+				break;
+			case SDMMC_QUEUE_NAND_ENCRYPT_WRITE:
+				retval = my_sdmmc_nand_encrypt_writesectors(entry->start, entry->count, entry->buffer);
+				break;
+		}
+
+		queue->next++;
+		entry->status = retval == 0 ? SDMMC_QUEUE_DONE : SDMMC_QUEUE_FAILED;
+	}
+	return true;
+}
+
+#ifdef NAND_PROFILE
+//---------------------------------------------------------------------------------
+static void my_sdmmcProfileHandler(void *address, void *user_data)
+//---------------------------------------------------------------------------------
+{
+	cpuStartTiming(0);
+	sdmmcProfile = (SdmmcProfile*)address;
+}
+#endif
+
+//---------------------------------------------------------------------------------
+// FIFO_SDMMC stays with libnds, sd card access and the plain nand transfers
+// go through its driver as they always did. only the ring is served from here
+void installSdmmcQueueFIFO()
+//---------------------------------------------------------------------------------
+{
+	fifoSetAddressHandler(FIFO_SDMMC_QUEUE, my_sdmmcQueueHandler, 0);
+#ifdef NAND_PROFILE
+	fifoSetAddressHandler(FIFO_SDMMC_PROFILE, my_sdmmcProfileHandler, 0);
+#endif
+}
+
 //---------------------------------------------------------------------------------
 int my_sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, void *out)
 //---------------------------------------------------------------------------------
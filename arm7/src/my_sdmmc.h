@@ -104,6 +104,22 @@
 #define TMIO_MASK_READOP  (TMIO_STAT1_RXRDY | TMIO_STAT1_DATAEND)
 #define TMIO_MASK_WRITEOP (TMIO_STAT1_TXRQ | TMIO_STAT1_DATAEND)
 
+// NDMA, used to stream sector data to and from the controller fifo
+#define MY_SDMMC_NDMA_CHANNEL   1
+
+#define REG_NDMA_SAD(ch)        (*(vu32*)(0x04004104 + (ch) * 0x1C))
+#define REG_NDMA_DAD(ch)        (*(vu32*)(0x04004108 + (ch) * 0x1C))
+#define REG_NDMA_TCNT(ch)       (*(vu32*)(0x0400410C + (ch) * 0x1C))
+#define REG_NDMA_WCNT(ch)       (*(vu32*)(0x04004110 + (ch) * 0x1C))
+#define REG_NDMA_BCNT(ch)       (*(vu32*)(0x04004114 + (ch) * 0x1C))
+#define REG_NDMA_CNT(ch)        (*(vu32*)(0x0400411C + (ch) * 0x1C))
+
+#define NDMA_DST_FIX            (2 << 10)
+#define NDMA_SRC_FIX            (2 << 13)
+#define NDMA_BLOCK_WORDS(log2)  ((log2) << 16)
+#define NDMA_START_SDMMC        (0x08 << 24)
+#define NDMA_ENABLE             (1u << 31)
+
 typedef struct mmcdevice {
 	u8* rData;
 	const u8* tData;
@@ -136,6 +152,14 @@ int my_sdmmc_sdcard_init();
 int my_sdmmc_nand_init();
 void my_sdmmc_get_cid(int devicenumber, u32 *cid);
 
+// serves the nand request ring on FIFO_SDMMC_QUEUE, FIFO_SDMMC stays with the
+// libnds handlers that installSystemFIFO sets up
+void installSdmmcQueueFIFO();
+// the fifo handler only takes note of a kick, this carries out the requests
+// from the main loop so interrupts stay on during the transfers. returns
+// false if there was nothing to do
+bool my_sdmmc_run_queue();
+
 static inline void sdmmc_nand_cid( u32 *cid)
 {
 	my_sdmmc_get_cid(MMC_DEVICE_NAND, cid);
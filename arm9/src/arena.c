@@ -0,0 +1,72 @@
+#include "arena.h"
+#include <malloc.h>
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static u8* arenaBase = NULL;
+static u32 arenaSize = 0;
+// offsets of the two ends, scratch is [0, bottom), persistent [top, arenaSize)
+static u32 bottom = 0;
+static u32 top = 0;
+
+bool arenaInit(u32 size)
+{
+	if (arenaBase)
+		return true;
+
+	size = ARENA_ROUND(size);
+	arenaBase = (u8*)memalign(ARENA_ALIGN, size);
+	if (!arenaBase)
+		return false;
+
+	arenaSize = size;
+	bottom = 0;
+	top = size;
+	return true;
+}
+
+void* arenaAlloc(u32 size)
+{
+	size = ARENA_ROUND(size);
+	if (!arenaBase || size > top - bottom)
+		return NULL;
+	void* ptr = arenaBase + bottom;
+	bottom += size;
+	return ptr;
+}
+
+ArenaMark arenaMark()
+{
+	return bottom;
+}
+
+void arenaReset(ArenaMark mark)
+{
+	if (mark <= bottom)
+		bottom = mark;
+}
+
+void* arenaAllocPersistent(u32 size)
+{
+	size = ARENA_ROUND(size);
+	if (!arenaBase || size > top - bottom)
+		return NULL;
+	top -= size;
+	return arenaBase + top;
+}
+
+ArenaMark arenaPersistentMark()
+{
+	return top;
+}
+
+void arenaPersistentReset(ArenaMark mark)
+{
+	if (mark >= top && mark <= arenaSize)
+		top = mark;
+}
+
+u32 arenaAvailable()
+{
+	return top - bottom;
+}
@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <nds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// one block set up at startup that the I/O buffers are carved from, so peak
+// memory is fixed and long batch runs can't fragment the heap. everything is
+// handed out in whole cache lines, which is also what the DMA and AES paths need.
+// sized for the peak while the nand is mounted: two 64 KiB crypt buffers, the
+// 33 KiB sector cache and a few single sectors, plus 64 KiB of scratch for the
+// fat sync or the benchmark, about 226 KiB in all
+#define ARENA_SIZE  (256 * 1024)
+#define ARENA_ALIGN 32
+
+typedef u32 ArenaMark;
+
+// returns false if the block couldn't be reserved
+bool arenaInit(u32 size);
+
+// scratch grows from the bottom, taken and given back within one operation
+void* arenaAlloc(u32 size);
+ArenaMark arenaMark();
+void arenaReset(ArenaMark mark);
+
+// buffers that live as long as a mount grow down from the top, so they stay
+// put no matter what the operations around them do
+void* arenaAllocPersistent(u32 size);
+ArenaMark arenaPersistentMark();
+void arenaPersistentReset(ArenaMark mark);
+
+// bytes left between the two ends
+u32 arenaAvailable();
+
+#ifdef __cplusplus
+}
+
+#include <format>
+#include <string_view>
+
+// std::format without a heap string, the text is nul terminated and lives
+// until the scratch is reset below it, an empty view if it didn't fit
+template<typename... Args>
+std::string_view arenaFormat(std::format_string<Args...> fmt, Args&&... args)
+{
+	auto size = std::formatted_size(fmt, args...);
+	auto buffer = static_cast<char*>(arenaAlloc(size + 1));
+	if(!buffer)
+		return "";
+	*std::format_to(buffer, fmt, args...) = '\0';
+	return {buffer, size};
+}
+#endif
+
+#endif
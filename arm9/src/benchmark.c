@@ -0,0 +1,145 @@
+#include "benchmark.h"
+#include "main.h"
+#include "storage.h"
+#include "nand/crypto.h"
+#include "nand/nandio.h"
+#include "nand/sector0.h"
+#include <nds/sha1.h>
+#include "arena.h"
+#include <string.h>
+
+// the profiling build has timers 2 and 3
+#define BENCHMARK_TIMER    0
+
+#define BUFFER_SECTORS     64
+#define BUFFER_SIZE        (BUFFER_SECTORS * SECTOR_SIZE)
+
+#define CRYPT_BYTES        (2 * 1024 * 1024)
+#define NAND_READ_BYTES    (2 * 1024 * 1024)
+#define SD_FILE_BYTES      (4 * 1024 * 1024)
+#define SHA1_BYTES         (4 * 1024 * 1024)
+
+#define SD_SOURCE_PATH     "sd:/launcher-tmd-restorer-bench.src"
+#define SD_TARGET_PATH     "sd:/launcher-tmd-restorer-bench.dst"
+
+static FILE* csv = NULL;
+
+static void report(const char* test, u32 transfer, u32 bytes, u32 ticks)
+{
+	u32 ms = ticks / (BUS_CLOCK / 1000);
+	// hundredths of a MB/s, integer only so it doesn't need float printf
+	u32 rate = ms ? (u32)((u64)bytes * 100000 / (1024 * 1024) / ms) : 0;
+
+	iprintf("%-14.14s%5lu %4lu.%02lu MB/s\n", test, (unsigned long)transfer, (unsigned long)(rate / 100), (unsigned long)(rate % 100));
+	fprintf(csv, "%s,%lu,%lu,%lu,%lu.%02lu\n", test, (unsigned long)transfer, (unsigned long)bytes, (unsigned long)ms,
+			(unsigned long)(rate / 100), (unsigned long)(rate % 100));
+}
+
+static void benchCrypt(u8* buffer, const char* name, crypt_backend_t backend)
+{
+	crypt_backend_t old = dsi_nand_crypt_get_backend();
+	dsi_nand_crypt_set_backend(backend);
+
+	u32 start = cpuGetTiming();
+	for (u32 done = 0; done < CRYPT_BYTES; done += BUFFER_SIZE)
+		dsi_nand_crypt(buffer, buffer, done / AES_BLOCK_SIZE, BUFFER_SIZE / AES_BLOCK_SIZE);
+	report(name, BUFFER_SECTORS, CRYPT_BYTES, cpuGetTiming() - start);
+
+	dsi_nand_crypt_set_backend(old);
+}
+
+static void benchNandRead(u8* buffer, u32 sectors)
+{
+	u32 start = cpuGetTiming();
+	u32 done = 0;
+	for (u32 sector = 0; done < NAND_READ_BYTES; sector += sectors, done += sectors * SECTOR_SIZE)
+	{
+		if (!nand_ReadSectors(sector, sectors, buffer))
+			break;
+	}
+	report("nand read", sectors, done, cpuGetTiming() - start);
+}
+
+static void benchSdCopy(u8* buffer)
+{
+	FILE* out = fopen(SD_SOURCE_PATH, "wb");
+	if (!out)
+		return;
+	setvbuf(out, NULL, _IONBF, 0);
+
+	u32 start = cpuGetTiming();
+	u32 done = 0;
+	while (done < SD_FILE_BYTES && fwrite(buffer, BUFFER_SIZE, 1, out) == 1)
+		done += BUFFER_SIZE;
+	fclose(out);
+	report("sd write", BUFFER_SECTORS, done, cpuGetTiming() - start);
+
+	start = cpuGetTiming();
+	if (copyFilePart(SD_SOURCE_PATH, 0, done, SD_TARGET_PATH) == 0)
+		report("sd copy", BUFFER_SECTORS, done, cpuGetTiming() - start);
+
+	remove(SD_TARGET_PATH);
+	remove(SD_SOURCE_PATH);
+}
+
+static void benchSha1(u8* buffer)
+{
+	u8 digest[SHA1_LEN];
+	swiSHA1context_t ctx;
+	ctx.sha_block = 0; //this is weird but it has to be done
+	swiSHA1Init(&ctx);
+
+	u32 start = cpuGetTiming();
+	for (u32 done = 0; done < SHA1_BYTES; done += BUFFER_SIZE)
+		swiSHA1Update(&ctx, buffer, BUFFER_SIZE);
+	swiSHA1Final(digest, &ctx);
+	report("sha1", BUFFER_SECTORS, SHA1_BYTES, cpuGetTiming() - start);
+
+	start = cpuGetTiming();
+	swiSHA1Calc(digest, buffer, BUFFER_SIZE);
+	report("sha1 calc", BUFFER_SECTORS, BUFFER_SIZE, cpuGetTiming() - start);
+}
+
+bool runBenchmark()
+{
+	bool newFile = !fileExists(BENCHMARK_CSV_PATH);
+	csv = fopen(BENCHMARK_CSV_PATH, "a");
+	if (!csv)
+		return false;
+	if (newFile)
+		fprintf(csv, "test,sectors,bytes,ms,MB/s\n");
+
+	// aligned main ram, so the AES engine can take it as it is. big enough for
+	// the largest nand transfer, everything else uses the first BUFFER_SIZE
+	ArenaMark mark = arenaMark();
+	u8* buffer = (u8*)arenaAlloc(NAND_XFER_MAX_SECTORS * SECTOR_SIZE);
+	if (!buffer)
+	{
+		fclose(csv);
+		return false;
+	}
+	memset(buffer, 0xA5, NAND_XFER_MAX_SECTORS * SECTOR_SIZE);
+
+	clearScreen(&bottomScreen);
+	iprintf("Benchmarking...\n\n");
+	cpuStartTiming(BENCHMARK_TIMER);
+
+	benchCrypt(buffer, "aes-ctr sw", CRYPT_BACKEND_SOFTWARE);
+	if (nandio_hw_crypt())
+		benchCrypt(buffer, "aes-ctr hw", CRYPT_BACKEND_HARDWARE);
+
+	benchNandRead(buffer, 1);
+	benchNandRead(buffer, 8);
+	benchNandRead(buffer, 64);
+	// how long the arm7 spends in the fifo irq for one transfer at the cap
+	benchNandRead(buffer, NAND_XFER_MAX_SECTORS);
+
+	benchSdCopy(buffer);
+	benchSha1(buffer);
+
+	cpuEndTiming();
+	arenaReset(mark);
+	bool ok = fclose(csv) == 0;
+	csv = NULL;
+	return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <nds/ndstypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// appended to on every run, so before/after numbers end up side by side
+#define BENCHMARK_CSV_PATH "sd:/launcher-tmd-restorer-bench.csv"
+
+// times nand crypto, raw nand reads, sd copies and sha1, the nand must be
+// mounted already, false if the csv couldn't be written
+bool runBenchmark();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
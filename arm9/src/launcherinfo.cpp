@@ -0,0 +1,27 @@
+#include "launcherinfo.h"
+
+bool makeLauncherInfo(uint32_t tid, uint32_t appVersion, LauncherInfo& info)
+{
+	info.tid = tid;
+	info.region = static_cast<char>(tid & 0xFF);
+	info.appVersion = appVersion;
+	// every launcher update bumps the app by one and the title by 256
+	info.version = static_cast<uint16_t>(256 * appVersion);
+	return info.appName.format("{:08x}.app", appVersion)
+		&& info.contentPath.format("nand:/title/00030017/{:08x}/content", tid)
+		&& info.tmdPath.format("{}/title.tmd", info.contentPath.view())
+		&& info.appPath.format("{}/{}", info.contentPath.view(), info.appName.view());
+}
+
+const char* launcherRegionName(char region)
+{
+	switch(region) {
+	case 'C': return "C";
+	case 'E': return "U";
+	case 'J': return "J";
+	case 'K': return "K";
+	case 'P': return "E";
+	case 'U': return "A";
+	default: return "UNK";
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef LAUNCHERINFO_H
+#define LAUNCHERINFO_H
+
+#include <cstdint>
+
+#include "pathbuffer.h"
+
+// everything the restore flow needs about one launcher, parsed once from the
+// tid and app version instead of being sliced back out of its paths
+struct LauncherInfo {
+	uint32_t tid;        // low word, the high one is always 00030017
+	char region;         // last letter of the tid, 'E', 'J', 'P', ...
+	uint32_t appVersion; // the n of content/0000000n.app
+	uint16_t version;    // title version that app belongs to
+	PathBuffer<16> appName;
+	PathBuffer<> contentPath;
+	PathBuffer<> tmdPath;
+	PathBuffer<> appPath;
+};
+
+// fills info, false if a path didn't fit its buffer
+bool makeLauncherInfo(uint32_t tid, uint32_t appVersion, LauncherInfo& info);
+
+// the region as it's usually written, "UNK" for a letter we don't know
+const char* launcherRegionName(char region);
+
+#endif
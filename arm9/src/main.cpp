@@ -1,20 +1,27 @@
 #include <cstdint>
 #include <dirent.h>
 #include <format>
-#include <memory>
 #include <print>
 #include <string_view>
 
 #include "main.h"
 #include "message.h"
 #include "nand/nandio.h"
+#include "nand/fatraw.h"
+#include "nand/tmdsig.h"
+#include "profile.h"
+#include "benchmark.h"
+#include "ui.h"
+#include "arena.h"
 #include "storage.h"
 #include "version.h"
-#include "nitrofs.h"
-#include "deviceList.h"
 #include "sha1digest.h"
+#include "tmdcatalogue.h"
+#include "titlecheck.h"
+#include "launcherinfo.h"
 
 volatile bool programEnd = false;
+volatile u32 vblankCount = 0;
 static volatile bool arm7Exiting = false;
 volatile bool charging = false;
 volatile u8 batteryLevel = 0;
@@ -22,6 +29,10 @@ volatile u8 batteryLevel = 0;
 PrintConsole topScreen;
 PrintConsole bottomScreen;
 
+// the nand is mounted through this, io_dsi_nand_readonly for the runs that
+// only look at it
+static const DISC_INTERFACE* nandDisc = &io_dsi_nand;
+
 static void setupScreens()
 {
 	REG_DISPCNT = MODE_FB0;
@@ -35,6 +46,7 @@ static void setupScreens()
 
 	consoleInit(&topScreen, 3, BgType_Text4bpp, BgSize_T_256x256, 31, 0, true, true);
 	consoleInit(&bottomScreen, 3, BgType_Text4bpp, BgSize_T_256x256, 31, 0, false, true);
+	uiInit();
 
 	clearScreen(&bottomScreen);
 
@@ -47,8 +59,12 @@ static void cleanup()
 	clearScreen(&bottomScreen);
 	std::println("Unmounting NAND...");
 	fatUnmount("nand:");
-	std::println("Merging stages...");
-	nandio_shutdown();
+	if(nandDisc == &io_dsi_nand)
+		std::println("Merging stages...");
+	if(!nandDisc->shutdown())
+		std::println("\x1B[31mThe NAND was not fully written back\x1B[47m");
+	tmdsig_deinit();
+	profileReport();
 
 	fifoSendValue32(FIFO_USER_02, 0x54495845); // 'EXIT'
 
@@ -68,65 +84,35 @@ static void cleanup()
 	exitWithMessage(std::format("\x1B[31mError:\x1B[33m {}", error));
 }
 
-static auto getSourceAndTargetTmds() {
-	auto launcher_tmd_str = [] -> std::string {
-		uint32_t launcherTid;
-		{
-			auto* file = fopen("nand:/sys/HWINFO_S.dat", "rb");
-			if(!file)
-				abortWithError("Could not open HWINFO_S.dat");
-			fseek(file, 0xA0, SEEK_SET);
-			fread(&launcherTid, sizeof(uint32_t), 1, file);
-			fclose(file);
-		}
-		return std::format("{:08x}", launcherTid);
-	}();
-
-	auto launcher_content_path = std::format("nand:/title/00030017/{}/content", launcher_tmd_str);
-
-	auto [expected_launcher_version, launcher_app_name] = [&] {
-		std::shared_ptr<DIR> pdir{opendir(launcher_content_path.c_str()), closedir};
-		if (!pdir)
-			abortWithError(std::format("Could not open launcher title directory ({})", launcher_content_path));
-		dirent* pent;
-		while((pent = readdir(pdir.get())) != nullptr) {
-			if(pent->d_type == DT_DIR)
-				continue;
-			std::string_view filename{pent->d_name};
-			if(filename.size() != 12 || !filename.ends_with(".app") || !filename.starts_with("0000000"))
-				continue;
-			auto launcher_app_version = static_cast<uint16_t>(static_cast<unsigned char>(filename[7]) - static_cast<unsigned char>('0'));
-			if(launcher_app_version > 7)
-				abortWithError(std::format("Found an unsupported launcher version: {}", launcher_app_version));
-			return std::pair{256 * launcher_app_version, std::string{filename}};
-		}
+static const TmdCatalogueEntry* getSourceTmd(LauncherInfo& launcher) {
+	// tid and app version come from the startup probe, looked up by path
+	if(!nandio_resolve_launcher()) {
+		if(nandio_get_info()->launcherTid == 0)
+			abortWithError("Could not open HWINFO_S.dat");
 		abortWithError("Launcher app not found");
-	}();
+	}
+	const auto* info = nandio_get_info();
+	if(info->launcherAppVersion > 7)
+		abortWithError(std::format("Found an unsupported launcher version: {}", info->launcherAppVersion));
+	if(!makeLauncherInfo(info->launcherTid, info->launcherAppVersion, launcher))
+		abortWithError("Launcher paths don't fit");
+
+	auto* sourceTmd = findCatalogueTmd(launcher.tid, launcher.version);
+	if(!sourceTmd)
+		abortWithError(std::format("No known tmd for launcher {:08x} ({}) v{}", launcher.tid, launcher.region, launcher.version));
 
-	return std::tuple{std::format("nitro:/{}/tmd.{}", launcher_tmd_str, static_cast<int>(expected_launcher_version)),
-					  std::format("{}/title.tmd", launcher_content_path),
-					  std::format("{}/{}", launcher_content_path, launcher_app_name)};
+	return sourceTmd;
 }
 
-auto checkTmdAndReadBuffer(auto sourceTmdPath, auto targetTmdPath)
+auto checkTmdAndReadBuffer(const TmdCatalogueEntry& sourceTmd, const LauncherInfo& launcher)
 {
-	auto expectedSha1Tmd = [&] -> Sha1Digest {
-		auto file = fopen(std::format("{}.sha1", sourceTmdPath).data(), "rb");
-		if(!file)
-			abortWithError("Tmd sha1 not found");
-		char sha1StrBuff[41]{};
-		auto read = fread(sha1StrBuff, sizeof(sha1StrBuff) - 1, 1, file);
-		fclose(file);
-		if(read != 1)
-			abortWithError("Failed to parse good tmd's sha1 file");
-		return {sha1StrBuff};
-	}();
+	const auto& expectedSha1Tmd = sourceTmd.digest;
 
 	auto actualSha1Tmd = [&] -> Sha1Digest {
 		Sha1Digest ret;
-		auto* targetTmd = fopen(targetTmdPath.data(), "rb");
+		auto* targetTmd = fopen(launcher.tmdPath.data(), "rb");
 		if(!targetTmd)
-			abortWithError(std::format("Failed to open target tmd ({})", targetTmdPath));
+			abortWithError(std::format("Failed to open target tmd ({})", launcher.tmdPath.view()));
 
 		if(!calculateFileSha1(targetTmd, ret.data())) {
 			fclose(targetTmd);
@@ -138,19 +124,12 @@ auto checkTmdAndReadBuffer(auto sourceTmdPath, auto targetTmdPath)
 	}();
 
 	auto sourceTmdBuffer = [&] {
-		auto* sourceTmd = fopen(sourceTmdPath.data(), "rb");
-		if(!sourceTmd)
-			abortWithError(std::format("Failed to open source tmd ({})", sourceTmdPath));
-
-		std::array<uint8_t, 520>  ret;
-		auto read = fread(ret.data(), ret.size(), 1, sourceTmd);
-		fclose(sourceTmd);
-		if(read != 1)
-			abortWithError(std::format("Failed to read source tmd ({})", sourceTmdPath));
+		auto ret = decodeCatalogueTmd(sourceTmd);
+		// the table is built from the .sha1 files, make sure it agrees with itself
 		Sha1Digest digest;
 		swiSHA1Calc(digest.data(), ret.data(), ret.size());
 		if(digest != expectedSha1Tmd)
-			abortWithError(std::format("Source tmd's hash doesn't match ({})", sourceTmdPath));
+			abortWithError(std::format("Source tmd's hash doesn't match ({:08x} v{})", sourceTmd.tid, sourceTmd.version));
 		return ret;
 	}();
 
@@ -159,14 +138,166 @@ auto checkTmdAndReadBuffer(auto sourceTmdPath, auto targetTmdPath)
 		exitWithMessage("The tmd is correct, no further action needed");
 	}
 
+	if(isSignedTmd(launcher.contentPath, 0x00030017, sourceTmd.tid))
+	{
+		exitWithMessage("The tmd is validly signed, no further action needed");
+	}
+
 	return sourceTmdBuffer;
 }
 
+// copies every file of the launcher's content folder to a fresh numbered
+// folder on the sd card, each copy is hashed back and compared
+static void backupLauncherContent(const LauncherInfo& launcher)
+{
+	// all the paths are scratch, given back once the backup is done
+	auto mark = arenaMark();
+	auto tidPath = arenaFormat("sd:/launcher-tmd-restorer/{:08x}", launcher.tid);
+	if(!safeCreateDir("sd:/launcher-tmd-restorer") || !safeCreateDir(tidPath.data()))
+		abortWithError("Failed to create the backup folder");
+
+	auto backupPath = [&] {
+		auto probeMark = arenaMark();
+		for(int i = 0;; ++i) {
+			arenaReset(probeMark);
+			auto path = arenaFormat("{}/{}", tidPath, i);
+			if(path.empty() || !fileExists(path.data()))
+				return path;
+		}
+	}();
+	if(!safeCreateDir(backupPath.data()))
+		abortWithError("Failed to create the backup folder");
+
+	DirHandle pdir{opendir(launcher.contentPath.data())};
+	if(!pdir)
+		abortWithError(std::format("Could not open launcher title directory ({})", launcher.contentPath.view()));
+	dirent* pent;
+	while((pent = readdir(pdir.get())) != nullptr) {
+		if(pent->d_type == DT_DIR)
+			continue;
+		auto fileMark = arenaMark();
+		auto src = arenaFormat("{}/{}", launcher.contentPath.view(), pent->d_name);
+		auto dst = arenaFormat("{}/{}", backupPath, pent->d_name);
+		clearScreen(&bottomScreen);
+		std::println("Backing up {}...", pent->d_name);
+		Sha1Digest srcDigest, dstDigest;
+		if(!copyFileSha1(src.data(), dst.data(), srcDigest.data()))
+			abortWithError(std::format("Failed to back up {}", src));
+		if(!calculateFileSha1Path(dst.data(), dstDigest.data()) || srcDigest != dstDigest)
+			abortWithError(std::format("Backup of {} doesn't match", src));
+		arenaReset(fileMark);
+	}
+	clearScreen(&bottomScreen);
+	std::println("Backed up to {}", backupPath);
+	arenaReset(mark);
+}
+
+// returns nullptr on success, otherwise what went wrong
+static const char* writeTmdWithLibfat(const char* tmdPath, const uint8_t* data, size_t size)
+{
+	// Unlaunch might've left us a nice gift
+	if(!toggleFileReadOnly(tmdPath, false))
+		return "Failed to mark target tmd as writable";
+
+	auto targetTmd = fopen(tmdPath, "r+b");
+	if(!targetTmd)
+		return "Failed to open target tmd";
+
+	if (ftruncate(fileno(targetTmd), size) != 0) {
+		fclose(targetTmd);
+		return "Failed to truncate target tmd as right size";
+	}
+	fseek(targetTmd, 0, SEEK_SET);
+	auto written = fwrite(data, size, 1, targetTmd);
+	fclose(targetTmd);
+	if(written != 1)
+		return "Faied to write tmd";
+	return nullptr;
+}
+
+[[noreturn]] static void checkAllLaunchers()
+{
+	clearScreen(&bottomScreen);
+	std::println("Checking launcher titles...");
+	auto results = checkLauncherTitles();
+
+	clearScreen(&topScreen);
+	size_t ok = 0, unknown = 0, repairable = 0;
+	for(const auto& title : results) {
+		switch(title.status) {
+		case TitleStatus::Ok:
+			++ok;
+			continue;
+		case TitleStatus::Unknown:
+			++unknown;
+			continue;
+		case TitleStatus::Mismatch:
+			if(title.expected)
+				++repairable;
+			std::println("\x1B[31mBAD\x1B[47m  {:08x}/{:08x}{}", title.tidHigh, title.tidLow,
+						 title.expected ? std::format(" -> v{}", title.expected->version) : "");
+			break;
+		case TitleStatus::Unreadable:
+			std::println("\x1B[33mMISS\x1B[47m {:08x}/{:08x}", title.tidHigh, title.tidLow);
+			break;
+		}
+	}
+
+	auto summary = std::format("Checked {} launchers\n\n{} ok\n{} unknown to the catalogue\n{} bad or unreadable",
+							   results.size(), ok, unknown, results.size() - ok - unknown);
+
+	if(ok > 0 && choiceBox(std::format("{}\n\nAlso verify the .app files\nof the ok titles?", summary).data()) == YES) {
+		clearScreen(&bottomScreen);
+		std::println("Hashing title contents...");
+		// the bad ones are listed under the tmds
+		consoleSelect(&topScreen);
+		size_t checked = 0, bad = 0;
+		for(const auto& title : results) {
+			if(title.status != TitleStatus::Ok)
+				continue;
+			for(const auto& content : checkTitleContents(title.tidHigh, title.tidLow)) {
+				++checked;
+				if(content.status == TitleStatus::Ok)
+					continue;
+				++bad;
+				std::println("{} {:08x}/{:08x}.app", content.status == TitleStatus::Mismatch ? "\x1B[31mBAD\x1B[47m " : "\x1B[33mMISS\x1B[47m",
+							 title.tidLow, content.contentId);
+			}
+		}
+		summary += std::format("\n{} of {} .app files bad", bad, checked);
+	}
+	if(repairable == 0 || nandDisc != &io_dsi_nand)
+		exitWithMessage(summary);
+
+	if(choiceBox(std::format("{}\n\nRepair {} tmds?", summary, repairable).data()) == NO)
+		exitWithMessage("Aborted");
+
+	if(!nandio_unlock_writing())
+		abortWithError("Failed to mount the nand as writable");
+
+	size_t repaired = 0;
+	for(const auto& title : results) {
+		if(title.status != TitleStatus::Mismatch || !title.expected)
+			continue;
+		auto tmd = decodeCatalogueTmd(*title.expected);
+		if(auto error = writeTmdWithLibfat(title.tmdPath.data(), tmd.data(), tmd.size()); error)
+			std::println("\x1B[31m{:08x}:\x1B[47m {}", title.tidLow, error);
+		else
+			++repaired;
+	}
+	exitWithMessage(std::format("Done\n\nRepaired {} of {} tmds", repaired, repairable));
+}
+
 int main(int argc, char **argv)
 {
 	keysSetRepeat(25, 5);
 	setupScreens();
 
+	irqSet(IRQ_VBLANK, []{
+		vblankCount = vblankCount + 1;
+		uiVBlank();
+	});
+
 	fifoSetValue32Handler(FIFO_USER_01, [](u32 value32, void* userdata){
 		if (value32 == 0x54495845) // 'EXIT'
 		{
@@ -187,58 +318,59 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	profileInit();
+
+	// before anything mounts, the nand buffers are the first thing taken from it
+	if (!arenaInit(ARENA_SIZE))
+		abortWithError("Not enough memory for the I/O buffers");
+
 	if (!fatInitDefault())
 		abortWithError("fatInitDefault()...\x1B[31mFailed\n\x1B[47m");
 
+	// hold L+R+Select while booting to only run the benchmark, L+R+Y to only
+	// check the launcher titles, neither writes to the nand so it's mounted read-only
+	scanKeys();
+	auto held = keysHeld();
+	bool benchmarkOnly = (held & (KEY_L | KEY_R | KEY_SELECT)) == (KEY_L | KEY_R | KEY_SELECT);
+	bool checkOnly = (held & (KEY_L | KEY_R | KEY_Y)) == (KEY_L | KEY_R | KEY_Y);
+	if(benchmarkOnly || checkOnly)
+		nandDisc = &io_dsi_nand_readonly;
+
 	//setup nand access
-	if (!fatMountSimple("nand", &io_dsi_nand))
+	if (!fatMountSimple("nand", nandDisc))
 		abortWithError("nand init \x1B[31mfailed\n\x1B[47m");
 
-	while (batteryLevel < 7 && !charging)
-	{
-		if (choiceBox("\x1B[47mBattery is too low!\nPlease plug in the console.\n\nContinue?") == NO)
-			return 0;
+	// without the keys nothing passes the signature check, the catalogue
+	// hashes still work
+	tmdsig_init("nand:/sys/cert.sys");
+
+	if(benchmarkOnly) {
+		if(!runBenchmark())
+			abortWithError("Failed to write " BENCHMARK_CSV_PATH);
+		exitWithMessage("Benchmark results saved to\n" BENCHMARK_CSV_PATH);
 	}
 
-	DeviceList* deviceList = getDeviceList();
+	if(checkOnly)
+		checkAllLaunchers();
 
-	auto applicationPath = [&] -> const char* {
-		if(argc > 0)
-			return argv[0];
-		if(deviceList)
-			return deviceList->appname;
-		return "sd:/ntrboot.nds";
-	}();
-
-	if (!nitroFSInit(applicationPath))
+	while (batteryLevel < 7 && !charging)
 	{
-		abortWithError("nitroFSInit()...\x1B[31mFailed\n\x1B[47m");
+		if (choiceBox("\x1B[47mBattery is too low!\nPlease plug in the console.\n\nContinue?") == NO)
+			return 0;
 	}
 
 	clearScreen(&topScreen);
 
-	auto [sourceTmdPath, targetTmdPath, launcherAppPath] = getSourceAndTargetTmds();
+	LauncherInfo launcher;
+	auto* sourceTmd = getSourceTmd(launcher);
 
 	clearScreen(&topScreen);
 	std::println("\tLauncher tmd restorer");
 	std::println("\nversion {}", VERSION);
 	std::println("\nedo9300 - 2024");
-	std::print("\x1b[10;0HDetected launcher version: v{}", sourceTmdPath.substr(20));
-	std::print("\x1b[11;0HDetected launcher region: {}", [&] {
-		if(auto launcherTidString = sourceTmdPath.substr(13,2); launcherTidString == "43")
-			return "C";
-		else if(launcherTidString == "45")
-			return "U";
-		else if(launcherTidString == "4a")
-			return "J";
-		else if(launcherTidString == "4b")
-			return "K";
-		else if(launcherTidString == "50")
-			return "E";
-		else if(launcherTidString == "55")
-			return "A";
-		return "UNK";
-	}());
+	std::print("\x1b[10;0HDetected launcher version: v{}", sourceTmd->version);
+	std::print("\x1b[11;0HDetected launcher region: {}", launcherRegionName(launcher.region));
+	std::print("\x1b[12;0HNAND crypto: {}", nandio_hw_crypt() ? "AES engine" : "software");
 	
 
 	messageBox("\x1B[41mWARNING:\x1B[47m This tool can write to\n"
@@ -248,33 +380,52 @@ int main(int argc, char **argv)
 				"and should be done with caution!\n\n"
 				"If you have not yet done so,\n"
 				"you should make a NAND backup.");
+
+	if(choiceBox("Check the tmds of all\n"
+				 "launchers instead?") == YES)
+		checkAllLaunchers();
 				
-	auto correctTmdBuffer = checkTmdAndReadBuffer(sourceTmdPath, targetTmdPath);
+	auto correctTmdBuffer = checkTmdAndReadBuffer(*sourceTmd, launcher);
 
 	if(choiceBox("Do you want to restore\n"
 				 "the launcher's tmd?") == NO)
 		exitWithMessage("Aborted");
 
+	if(choiceBox("Back up the launcher's content\n"
+				 "folder to the SD card first?") == YES)
+		backupLauncherContent(launcher);
+
 	if(!nandio_unlock_writing())
 		abortWithError("Failed to mount the nand as writable");
 
-	// Unlaunch might've left us a nice gift
-	if(!toggleFileReadOnly(targetTmdPath.data(), false))
-		abortWithError("Failed to mark target tmd as writable");
-	if(!toggleFileReadOnly(launcherAppPath.data(), false))
-		abortWithError("Failed to mark launcher app as writable");
+	// when the tmd's clusters can hold the right one as they are, write them
+	// directly and only touch its directory entry
+	auto rewrite = fatraw_init_geometry(&io_dsi_nand, &nandio_get_info()->fat)
+		? fatraw_rewrite_file(launcher.tmdPath.data(), correctTmdBuffer.data(), correctTmdBuffer.size())
+		: FATRAW_REWRITE_UNSUPPORTED;
+	// libfat would work on a half written file with stale entries cached, and
+	// the other fat copies still describe the old one
+	if(rewrite == FATRAW_REWRITE_FAILED) {
+		nandio_hold_fat_copies();
+		abortWithError("Failed partway through rewriting the tmd,\nrestore your NAND backup");
+	}
+	if(rewrite == FATRAW_REWRITE_OK) {
+		// libfat's cache still has the old entries, it must not write to them from now on
+		if(!fatraw_set_attributes(launcher.appPath.data(), 0, FATRAW_ATTR_READONLY))
+			abortWithError("Failed to mark launcher app as writable");
+		const sec_t* touched;
+		auto count = fatraw_touched_sectors(&touched);
+		std::string list;
+		for(uint32_t i = 0; i < count && i < FATRAW_MAX_TOUCHED; ++i)
+			list += std::format("{}{}", i ? ", " : "", touched[i]);
+		exitWithMessage(std::format("Done\n\nWrote sectors: {}", list));
+	}
 
-	auto targetTmd = fopen(targetTmdPath.data(), "r+b");
+	if(!toggleFileReadOnly(launcher.appPath.data(), false))
+		abortWithError("Failed to mark launcher app as writable");
 
-	if (ftruncate(fileno(targetTmd), 520) != 0) {
-		fclose(targetTmd);
-		abortWithError("Failed to truncate target tmd as right size");
-	}
-	fseek(targetTmd, 0, SEEK_SET);
-	auto written = fwrite(correctTmdBuffer.data(), correctTmdBuffer.size(), 1, targetTmd);
-	fclose(targetTmd);
-	if(written != 1)
-		abortWithError("Faied to write tmd");
+	if(auto error = writeTmdWithLibfat(launcher.tmdPath.data(), correctTmdBuffer.data(), correctTmdBuffer.size()); error)
+		abortWithError(error);
 
 	exitWithMessage("Done");
 }
@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
 extern volatile bool programEnd;
+// bumped by the vblank irq, for anything that needs a sense of time
+extern volatile u32 vblankCount;
 
 extern PrintConsole topScreen;
 extern PrintConsole bottomScreen;
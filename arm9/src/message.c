@@ -1,5 +1,6 @@
 #include "message.h"
 #include "main.h"
+#include "ui.h"
 
 void keyWait(u32 key)
 {
@@ -24,20 +25,20 @@ bool choiceBox(const char* message)
 	iprintf("%s\n", message);
 	iprintf("\x1B[47m");	//white
 	iprintf("\x1b[%d;0H\tYes\n\tNo\n", choiceRow);
+	uiPutChar(&bottomScreen, choiceRow, 0, '>', UI_WHITE);
 
 	while (!programEnd)
 	{
 		swiWaitForVBlank();
 		scanKeys();
 
-		//Clear cursor
-		iprintf("\x1b[%d;0H ", choiceRow + cursor);
-
+		//Move cursor, only the two cells change
 		if (keysDown() & (KEY_UP | KEY_DOWN))
+		{
+			uiPutChar(&bottomScreen, choiceRow + cursor, 0, ' ', UI_WHITE);
 			cursor = !cursor;
-
-		//Print cursor
-		iprintf("\x1b[%d;0H>", choiceRow + cursor);
+			uiPutChar(&bottomScreen, choiceRow + cursor, 0, '>', UI_WHITE);
+		}
 
 		if (keysDown() & (KEY_A | KEY_START))
 			break;
@@ -91,6 +92,7 @@ bool randomConfirmBox(const char* message)
 {
 	const int choiceRow = 10;
 	int sequencePosition = 0;
+	int drawnPosition = -1;
 
 	u8 sequence[8];
 	for (int i = 0; i < sizeof(sequence); i++)
@@ -110,12 +112,16 @@ bool randomConfirmBox(const char* message)
 		swiWaitForVBlank();
 		scanKeys();
 
-		//Print sequence
-		iprintf("\x1b[%d;0H", choiceRow);
-		for (int i = 0; i < sizeof(sequence); i++)
+		//Print sequence, only when the progress through it changed
+		if (sequencePosition != drawnPosition)
 		{
-			iprintf("\x1B[%0om", i < sequencePosition ? 032 : 047);
-			iprintf("%s ", keysLabels[sequence[i]]);
+			iprintf("\x1b[%d;0H", choiceRow);
+			for (int i = 0; i < sizeof(sequence); i++)
+			{
+				iprintf("\x1B[%0om", i < sequencePosition ? 032 : 047);
+				iprintf("%s ", keysLabels[sequence[i]]);
+			}
+			drawnPosition = sequencePosition;
 		}
 
 		if (keysDown() & (KEY_UP | KEY_DOWN | KEY_RIGHT | KEY_LEFT | KEY_A | KEY_B | KEY_X | KEY_Y))
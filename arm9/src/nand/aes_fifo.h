@@ -0,0 +1,40 @@
+#ifndef AES_FIFO_H
+#define AES_FIFO_H
+#include <nds/ndstypes.h>
+#include <nds/fifocommon.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// kept in sync between arm7/src/aes_fifo.h and arm9/src/nand/aes_fifo.h
+#define FIFO_AES FIFO_USER_04
+
+// the AES engine can't count more than 0xFFFF blocks in a single run
+#define AES_FIFO_MAX_BLOCKS 0xFFFF
+
+// keyslot the es normal key is loaded into, 0 is only used for modcrypt
+#define AES_ES_KEYSLOT 0
+
+typedef enum {
+	AES_FIFO_NAND_CTR, // ctr crypt using the nand key in keyslot 3
+	AES_FIFO_ES_SET_KEY, // load the normal key in iv into AES_ES_KEYSLOT
+	AES_FIFO_ES_CCM_ENCRYPT, // ccm with a 16 byte mac, written to mac
+	AES_FIFO_ES_CCM_DECRYPT, // ccm checking the 16 byte mac in mac
+	AES_FIFO_NAND_SET_CTR, // remember iv as the counter of nand sector 0, for the sdmmc crypt requests
+} AesFifoCommand;
+
+typedef struct AesFifoMessage {
+	u32 command;
+	u32 iv[4]; // ctr: counter of the first block, ccm: nonce in the first 3 words, little endian words
+	const void* in;
+	void* out;
+	u32 blocks;
+	void* mac; // ccm only, 16 bytes in main ram
+} AesFifoMessage;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
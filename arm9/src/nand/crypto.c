@@ -1,8 +1,9 @@
 #include <stdint.h>
 #include "crypto.h"
-#include "u128_math.h"
 #include "f_xy.h"
 #include "twltool/dsi.h"
+#include "aes_fifo.h"
+#include "../profile.h"
 
 // more info:
 //		https://github.com/Jimmy-Z/TWLbf/blob/master/dsi.c
@@ -13,8 +14,11 @@ static dsi_context nand_ctx;
 static dsi_context boot2_ctx;
 static dsi_es_context es_ctx;
 
-static uint8_t nand_ctr_iv[16];
-static uint8_t boot2_ctr[16];
+static dsi_ctr nand_ctr_iv;
+static dsi_ctr boot2_ctr;
+
+static crypt_backend_t nand_backend = CRYPT_BACKEND_SOFTWARE;
+static crypt_backend_t es_backend = CRYPT_BACKEND_SOFTWARE;
 
 static void generate_key(uint8_t *generated_key, const uint32_t *console_id, const key_mode_t mode)
 {
@@ -42,10 +46,7 @@ static void generate_key(uint8_t *generated_key, const uint32_t *console_id, con
 		default:
 			break;
 	}
-	u128_xor((uint8_t *)key, mode == ES ? DSi_ES_KEY_Y : DSi_NAND_KEY_Y);
-	u128_add((uint8_t *)key, DSi_KEY_MAGIC);
-	u128_lrot((uint8_t *)key, 42);
-	memcpy(generated_key, key, 16);
+	F_XY(generated_key, (uint8_t *)key, mode == ES ? DSi_ES_KEY_Y : DSi_NAND_KEY_Y);
 }
 
 int dsi_sha1_verify(const void *digest_verify, const void *data, unsigned len)
@@ -74,7 +75,9 @@ void dsi_crypt_init(const uint8_t *console_id_be, const uint8_t *emmc_cid, int i
 
 	dsi_set_key(&boot2_ctx, DSi_BOOT2_KEY);
 
-	swiSHA1Calc(nand_ctr_iv, emmc_cid, 16);
+	uint8_t cid_hash[SHA1_LEN];
+	swiSHA1Calc(cid_hash, emmc_cid, 16);
+	dsi_ctr_load(&nand_ctr_iv, cid_hash);
 
 }
 
@@ -82,26 +85,164 @@ void dsi_crypt_init(const uint8_t *console_id_be, const uint8_t *emmc_cid, int i
 // offset as block offset, block as AES block
 void dsi_nand_crypt_1(uint8_t* out, const uint8_t* in, uint32_t offset)
 {
-	uint8_t ctr[16];
-	memcpy(ctr, nand_ctr_iv, sizeof(nand_ctr_iv));
-	u128_add32(ctr, offset);
-	dsi_set_ctr(&nand_ctx, ctr);
-	dsi_crypt_ctr(&nand_ctx, in, out, 16);
+	dsi_nand_crypt(out, in, offset, 1);
+}
+
+static void dsi_nand_crypt_sw(uint8_t* out, const uint8_t* in, uint32_t offset, unsigned count)
+{
+	dsi_ctr ctr = nand_ctr_iv;
+	dsi_ctr_add(&ctr, offset);
+	dsi_crypt_ctr_blocks(&nand_ctx, &ctr, in, out, count);
+}
+
+// the arm7 can only see main ram, and the cache maintenance needs whole lines
+static bool hw_buffer_usable(const void* buf, unsigned len)
+{
+	u32 addr = (u32)buf;
+	return (addr >> 24) == 0x02 && (addr & 31) == 0 && (len & 31) == 0;
+}
+
+// a chunk the arm7 turns down is left as it was, so the rest is done in
+// software and the engine isn't asked again
+static void dsi_nand_crypt_hw(uint8_t* out, const uint8_t* in, uint32_t offset, unsigned count)
+{
+	AesFifoMessage msg;
+	dsi_ctr ctr = nand_ctr_iv;
+	dsi_ctr_add(&ctr, offset);
+
+	DC_FlushRange(in, count * AES_BLOCK_SIZE);
+	if (out != in)
+		DC_FlushRange(out, count * AES_BLOCK_SIZE);
+
+	while (count > 0)
+	{
+		unsigned blocks = count > AES_FIFO_MAX_BLOCKS ? AES_FIFO_MAX_BLOCKS : count;
+		msg.command = AES_FIFO_NAND_CTR;
+		memcpy(msg.iv, ctr.w, sizeof(msg.iv));
+		msg.in = in;
+		msg.out = out;
+		msg.blocks = blocks;
+		fifoSendDatamsg(FIFO_AES, sizeof(msg), (u8*)&msg);
+		fifoWaitValue32(FIFO_AES);
+		int res = (int)fifoGetValue32(FIFO_AES);
+		DC_InvalidateRange(out, blocks * AES_BLOCK_SIZE);
+		if (res != 0)
+		{
+			nand_backend = CRYPT_BACKEND_SOFTWARE;
+			dsi_crypt_ctr_blocks(&nand_ctx, &ctr, in, out, count);
+			return;
+		}
+
+		dsi_ctr_add(&ctr, blocks);
+		out += blocks * AES_BLOCK_SIZE;
+		in += blocks * AES_BLOCK_SIZE;
+		count -= blocks;
+	}
 }
 
 void dsi_nand_crypt(uint8_t* out, const uint8_t* in, uint32_t offset, unsigned count)
 {
-	uint8_t ctr[16];
-	memcpy(ctr, nand_ctr_iv, sizeof(nand_ctr_iv));
-	u128_add32(ctr, offset);
-	for (unsigned i = 0; i < count; ++i)
+	u32 timing = profileStart();
+	if (nand_backend == CRYPT_BACKEND_HARDWARE
+		&& hw_buffer_usable(in, count * AES_BLOCK_SIZE)
+		&& hw_buffer_usable(out, count * AES_BLOCK_SIZE))
+	{
+		dsi_nand_crypt_hw(out, in, offset, count);
+	}
+	else
+	{
+		dsi_nand_crypt_sw(out, in, offset, count);
+	}
+	profileStop(PROFILE_NAND_CRYPT, timing, count * AES_BLOCK_SIZE, count * AES_BLOCK_SIZE / 512);
+}
+
+void dsi_nand_crypt_set_backend(crypt_backend_t backend)
+{
+	nand_backend = backend;
+	if (backend != CRYPT_BACKEND_HARDWARE)
+		return;
+
+	// the arm7 also needs the counter to crypt sectors straight off the nand
+	AesFifoMessage msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.command = AES_FIFO_NAND_SET_CTR;
+	memcpy(msg.iv, nand_ctr_iv.w, sizeof(msg.iv));
+	fifoSendDatamsg(FIFO_AES, sizeof(msg), (u8*)&msg);
+	fifoWaitValue32(FIFO_AES);
+	if (fifoGetValue32(FIFO_AES) != 0)
+		nand_backend = CRYPT_BACKEND_SOFTWARE;
+}
+
+crypt_backend_t dsi_nand_crypt_get_backend()
+{
+	return nand_backend;
+}
+
+// the mac passes through here on its way to and from the arm7, the caller's
+// copy may be on the stack in dtcm. a whole cache line, so invalidating it
+// can't touch anything else
+static u8 ccm_mac[32] __attribute__((aligned(32)));
+
+// the engine does the whole ccm pass, only the payload has to be in main ram
+static int dsi_es_ccm_hw(int encrypt, const unsigned char nonce[12], unsigned char* buffer, unsigned int size, unsigned char mac[16])
+{
+	u32 addr = (u32)buffer;
+	if ((addr >> 24) != 0x02 || (addr & 31) != 0 || (size & 15) != 0
+		|| size / AES_BLOCK_SIZE > AES_FIFO_MAX_BLOCKS)
+	{
+		return 1;
+	}
+
+	AesFifoMessage msg;
+	msg.command = encrypt ? AES_FIFO_ES_CCM_ENCRYPT : AES_FIFO_ES_CCM_DECRYPT;
+	memset(msg.iv, 0, sizeof(msg.iv));
+	memcpy(msg.iv, nonce, 12);
+	msg.in = buffer;
+	msg.out = buffer;
+	msg.blocks = size / AES_BLOCK_SIZE;
+	msg.mac = ccm_mac;
+	if (!encrypt)
+		memcpy(ccm_mac, mac, AES_BLOCK_SIZE);
+
+	DC_FlushRange(buffer, size);
+	DC_FlushRange(ccm_mac, sizeof(ccm_mac));
+	fifoSendDatamsg(FIFO_AES, sizeof(msg), (u8*)&msg);
+	fifoWaitValue32(FIFO_AES);
+	int res = (int)fifoGetValue32(FIFO_AES);
+	DC_InvalidateRange(buffer, size);
+	DC_InvalidateRange(ccm_mac, sizeof(ccm_mac));
+
+	if (res != 0)
+		return -1;
+	if (encrypt)
+		memcpy(mac, ccm_mac, AES_BLOCK_SIZE);
+	return 0;
+}
+
+void dsi_es_crypt_set_backend(crypt_backend_t backend)
+{
+	es_backend = backend;
+	es_ctx.ccm = 0;
+	if (backend != CRYPT_BACKEND_HARDWARE)
+		return;
+
+	AesFifoMessage msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.command = AES_FIFO_ES_SET_KEY;
+	memcpy(msg.iv, es_ctx.key, sizeof(msg.iv));
+	fifoSendDatamsg(FIFO_AES, sizeof(msg), (u8*)&msg);
+	fifoWaitValue32(FIFO_AES);
+	if (fifoGetValue32(FIFO_AES) != 0)
 	{
-		dsi_set_ctr(&nand_ctx, ctr);
-		dsi_crypt_ctr(&nand_ctx, in, out, 16);
-		out += AES_BLOCK_SIZE;
-		in += AES_BLOCK_SIZE;
-		u128_add32(ctr, 1);
+		es_backend = CRYPT_BACKEND_SOFTWARE;
+		return;
 	}
+	es_ctx.ccm = dsi_es_ccm_hw;
+}
+
+crypt_backend_t dsi_es_crypt_get_backend()
+{
+	return es_backend;
 }
 
 int dsi_es_block_crypt(uint8_t *buf, unsigned buf_len, crypt_mode_t mode)
@@ -116,23 +257,13 @@ int dsi_es_block_crypt(uint8_t *buf, unsigned buf_len, crypt_mode_t mode)
 
 void dsi_boot2_crypt_set_ctr(uint32_t size_r)
 {
-	for (int i=0;i<4;i++)
-	{
-		boot2_ctr[i] = (size_r) >> (8*i);
-		boot2_ctr[i+4] = (-size_r) >> (8*i);
-		boot2_ctr[i+8] = (~size_r) >> (8*i);
-		boot2_ctr[i+12] = 0;
-	}
+	boot2_ctr.w[0] = size_r;
+	boot2_ctr.w[1] = -size_r;
+	boot2_ctr.w[2] = ~size_r;
+	boot2_ctr.w[3] = 0;
 }
 
 void dsi_boot2_crypt(uint8_t* out, const uint8_t* in, unsigned count)
 {
-	for (unsigned i = 0; i < count; ++i)
-	{
-		dsi_set_ctr(&boot2_ctx, boot2_ctr);
-		dsi_crypt_ctr(&boot2_ctx, in, out, 16);
-		out += AES_BLOCK_SIZE;
-		in += AES_BLOCK_SIZE;
-		u128_add32(boot2_ctr, 1);
-	}
+	dsi_crypt_ctr_blocks(&boot2_ctx, &boot2_ctr, in, out, count);
 }
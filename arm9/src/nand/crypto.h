@@ -47,6 +47,11 @@ typedef enum {
 	ES
 } key_mode_t;
 
+typedef enum {
+	CRYPT_BACKEND_SOFTWARE, // polarssl
+	CRYPT_BACKEND_HARDWARE  // AES engine through the arm7, keyslot 3 (es: AES_ES_KEYSLOT)
+} crypt_backend_t;
+
 
 // don't want to include nds.h just for this
 void swiSHA1Calc(void *digest, const void *buf, size_t len);
@@ -59,6 +64,16 @@ void dsi_nand_crypt_1(uint8_t *out, const uint8_t* in, u32 offset);
 
 void dsi_nand_crypt(uint8_t *out, const uint8_t* in, u32 offset, unsigned count);
 
+void dsi_nand_crypt_set_backend(crypt_backend_t backend);
+
+crypt_backend_t dsi_nand_crypt_get_backend();
+
+// the hardware backend loads the es key into the engine, it's only used for
+// 32 byte aligned main ram buffers with a payload of whole blocks
+void dsi_es_crypt_set_backend(crypt_backend_t backend);
+
+crypt_backend_t dsi_es_crypt_get_backend();
+
 int dsi_es_block_crypt(uint8_t *buf, unsigned buf_len, crypt_mode_t mode);
 
 void dsi_boot2_crypt_set_ctr(uint32_t size_r);
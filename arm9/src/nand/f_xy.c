@@ -35,23 +35,35 @@ const uint8_t DSi_BOOT2_KEY[16] = {
 
 /************************ Functions *******************************************/
 
+// both work on native words copied out of the arguments, there are no data
+// dependent branches or memory accesses so the key doesn't leak through timing
 void F_XY(uint8_t *key, const uint8_t *key_x, const uint8_t *key_y)
 {
-	uint8_t key_xy[16];
+	uint32_t key_xy[4];
+	uint32_t y[4];
+	uint32_t magic[4];
 
-	for (int i=0; i<16; i++)
-		key_xy[i] = key_x[i] ^ key_y[i];
+	memcpy(key_xy, key_x, 16);
+	memcpy(y, key_y, 16);
+	memcpy(magic, DSi_KEY_MAGIC, 16);
 
-	memcpy(key, DSi_KEY_MAGIC, sizeof(DSi_KEY_MAGIC));
+	for (int i=0; i<4; i++)
+		key_xy[i] ^= y[i];
 
-	u128_add(key, key_xy);
-	u128_lrot(key, 42);
+	u128w_add(key_xy, magic);
+	u128w_lrot(key_xy, 42);
+	memcpy(key, key_xy, 16);
 }
 
 //F_XY_reverse does the reverse of F(X^Y): takes (normal)key, and does F in reverse to generate the original X^Y key_xy.
 void F_XY_reverse(const uint8_t *key, uint8_t *key_xy)
 {
-	memcpy(key_xy, key, 16);
-	u128_rrot(key_xy, 42);
-	u128_sub(key_xy, DSi_KEY_MAGIC);
+	uint32_t w[4];
+	uint32_t magic[4];
+
+	memcpy(w, key, 16);
+	memcpy(magic, DSi_KEY_MAGIC, 16);
+	u128w_rrot(w, 42);
+	u128w_sub(w, magic);
+	memcpy(key_xy, w, 16);
 }
@@ -0,0 +1,635 @@
+#include <nds.h>
+#include <string.h>
+#include <ctype.h>
+#include "fatraw.h"
+#include "sector0.h"
+
+/************************ Constants / Defines *********************************/
+
+#define DIR_ENTRY_SIZE        32
+#define DIR_ATTR              11
+#define DIR_CLUSTER_HIGH      20
+#define DIR_CLUSTER_LOW       26
+#define DIR_FILE_SIZE         28
+
+#define MAX_PATH_LEN          256
+
+// directories whose entries are kept decrypted in memory, and how many entries
+// one may have, bigger ones are read from the nand on every lookup
+#define DIR_CACHE_DIRS        16
+#define DIR_CACHE_ENTRIES     32
+
+// masked down to the fat's width when written
+#define FAT_END_OF_CHAIN      0x0FFFFFFF
+
+static const DISC_INTERFACE *fat_disc = 0;
+static fatraw_geometry geometry;
+
+static u32 sector_buf32[SECTOR_SIZE/sizeof(u32)] __attribute__((aligned(32)));
+static u8 *sector_buf = (u8*)sector_buf32;
+
+static sec_t touched[FATRAW_MAX_TOUCHED];
+static u32 touched_count = 0;
+
+typedef struct {
+	u8 raw[DIR_ENTRY_SIZE];
+	sec_t sector;
+	u32 offset;
+} dir_cache_entry;
+
+typedef struct {
+	bool valid;
+	bool complete;             // false if the directory didn't fit, it's walked on the nand then
+	u32 cluster;
+	u32 lastUse;
+	u32 count;
+	dir_cache_entry entries[DIR_CACHE_ENTRIES];
+} dir_cache_dir;
+
+static dir_cache_dir dir_cache[DIR_CACHE_DIRS];
+static u32 dir_cache_clock = 0;
+// set while fatraw writes itself, the cache is patched from those instead
+static bool writing_self = false;
+
+static u16 get16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 get32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static void put32(u8 *p, u32 value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+void fatraw_dir_cache_invalidate()
+{
+	if (writing_self)
+		return;
+	for (u32 i = 0; i < DIR_CACHE_DIRS; i++)
+		dir_cache[i].valid = false;
+}
+
+// brings the cached copies of any entries in sector up to date with data
+static void dir_cache_patch(sec_t sector, const u8 *data)
+{
+	for (u32 i = 0; i < DIR_CACHE_DIRS; i++)
+	{
+		dir_cache_dir *dir = &dir_cache[i];
+		if (!dir->valid)
+			continue;
+		for (u32 j = 0; j < dir->count; j++)
+		{
+			if (dir->entries[j].sector == sector)
+				memcpy(dir->entries[j].raw, data + dir->entries[j].offset, DIR_ENTRY_SIZE);
+		}
+	}
+}
+
+static bool write_sector(sec_t sector, const void *buffer)
+{
+	writing_self = true;
+	bool ok = fat_disc->writeSectors(sector, 1, buffer);
+	writing_self = false;
+	if (!ok)
+		return false;
+	dir_cache_patch(sector, buffer);
+	if (touched_count < FATRAW_MAX_TOUCHED)
+		touched[touched_count] = sector;
+	touched_count++;
+	return true;
+}
+
+bool fatraw_parse_boot_sector(const u8 *bootSector, u32 partitionStart, fatraw_geometry *out)
+{
+	memset(out, 0, sizeof(*out));
+	if (get16(bootSector + 0x0B) != SECTOR_SIZE || bootSector[0x0D] == 0 || bootSector[0x10] == 0)
+		return false;
+
+	u32 reserved = get16(bootSector + 0x0E);
+	u32 rootEntries = get16(bootSector + 0x11);
+	u32 totalSectors = get16(bootSector + 0x13);
+	if (totalSectors == 0)
+		totalSectors = get32(bootSector + 0x20);
+	out->sectorsPerFat = get16(bootSector + 0x16);
+	if (out->sectorsPerFat == 0)
+		out->sectorsPerFat = get32(bootSector + 0x24);
+
+	out->partitionStart = partitionStart;
+	out->sectorsPerCluster = bootSector[0x0D];
+	out->numFats = bootSector[0x10];
+	out->fatStart = partitionStart + reserved;
+	out->rootDirStart = out->fatStart + out->numFats * out->sectorsPerFat;
+	out->rootDirSectors = (rootEntries * DIR_ENTRY_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	out->dataStart = out->rootDirStart + out->rootDirSectors;
+	out->clusterCount = (totalSectors - (out->dataStart - partitionStart)) / out->sectorsPerCluster;
+
+	// the cluster count is what decides the fat type, not the label
+	if (out->clusterCount < 4085)
+		out->fatBits = 12;
+	else if (out->clusterCount < 65525)
+		out->fatBits = 16;
+	else
+		out->fatBits = 32;
+
+	return true;
+}
+
+bool fatraw_init(const DISC_INTERFACE *disc)
+{
+	fat_disc = 0;
+
+	if (!disc->readSectors(0, 1, sector_buf))
+		return false;
+	u32 partitionStart = ((mbr_t*)sector_buf)->partitions[0].offset;
+
+	fatraw_geometry parsed;
+	if (!disc->readSectors(partitionStart, 1, sector_buf)
+		|| !fatraw_parse_boot_sector(sector_buf, partitionStart, &parsed))
+		return false;
+
+	return fatraw_init_geometry(disc, &parsed);
+}
+
+bool fatraw_init_geometry(const DISC_INTERFACE *disc, const fatraw_geometry *known)
+{
+	touched_count = 0;
+	// the cache outlives calls on the same partition
+	if (disc != fat_disc || memcmp(&geometry, known, sizeof(geometry)) != 0)
+		fatraw_dir_cache_invalidate();
+	if (known->fatBits == 0)
+	{
+		fat_disc = 0;
+		return false;
+	}
+	fat_disc = disc;
+	geometry = *known;
+	return true;
+}
+
+const fatraw_geometry *fatraw_get_geometry()
+{
+	return fat_disc ? &geometry : 0;
+}
+
+u32 fatraw_next_cluster(u32 cluster)
+{
+	if (cluster < 2 || cluster >= geometry.clusterCount + 2)
+		return 0;
+
+	u32 byteOffset = geometry.fatBits == 12 ? cluster + cluster / 2 : cluster * (geometry.fatBits / 8);
+	sec_t sector = geometry.fatStart + byteOffset / SECTOR_SIZE;
+	u32 offset = byteOffset % SECTOR_SIZE;
+	u32 next;
+
+	if (!fat_disc->readSectors(sector, 1, sector_buf))
+		return 0;
+
+	if (geometry.fatBits == 12)
+	{
+		u32 value = sector_buf[offset];
+		// a fat12 entry can straddle two sectors
+		if (offset == SECTOR_SIZE - 1)
+		{
+			if (!fat_disc->readSectors(sector + 1, 1, sector_buf))
+				return 0;
+			value |= sector_buf[0] << 8;
+		}
+		else
+		{
+			value |= sector_buf[offset + 1] << 8;
+		}
+		next = (cluster & 1) ? value >> 4 : value & 0xFFF;
+		if (next >= 0xFF7)
+			return 0;
+	}
+	else if (geometry.fatBits == 16)
+	{
+		next = get16(sector_buf + offset);
+		if (next >= 0xFFF7)
+			return 0;
+	}
+	else
+	{
+		next = get32(sector_buf + offset) & 0x0FFFFFFF;
+		if (next >= 0x0FFFFFF7)
+			return 0;
+	}
+
+	return next >= 2 ? next : 0;
+}
+
+// writes a fat16/32 entry to the first copy of the fat only, the others are
+// left as they were until the caller syncs them once everything went through
+static bool set_fat_entry(u32 cluster, u32 value)
+{
+	if (geometry.fatBits == 12 || cluster < 2 || cluster >= geometry.clusterCount + 2)
+		return false;
+
+	u32 byteOffset = cluster * (geometry.fatBits / 8);
+	sec_t sector = geometry.fatStart + byteOffset / SECTOR_SIZE;
+	u8 *p = sector_buf + byteOffset % SECTOR_SIZE;
+	if (!fat_disc->readSectors(sector, 1, sector_buf))
+		return false;
+	if (geometry.fatBits == 16)
+	{
+		p[0] = value;
+		p[1] = value >> 8;
+	}
+	else
+	{
+		put32(p, (get32(p) & 0xF0000000) | (value & 0x0FFFFFFF));
+	}
+	return write_sector(sector, sector_buf);
+}
+
+sec_t fatraw_cluster_sector(u32 cluster)
+{
+	return geometry.dataStart + (cluster - 2) * geometry.sectorsPerCluster;
+}
+
+static bool to_short_name(const char *name, char shortName[11])
+{
+	memset(shortName, ' ', 11);
+	int i = 0;
+	for (; *name && *name != '.'; name++)
+	{
+		if (i == 8)
+			return false;
+		shortName[i++] = toupper((unsigned char)*name);
+	}
+	if (*name == '.')
+	{
+		name++;
+		for (i = 8; *name; name++)
+		{
+			if (i == 11 || *name == '.')
+				return false;
+			shortName[i++] = toupper((unsigned char)*name);
+		}
+	}
+	return shortName[0] != ' ';
+}
+
+// the sector'th sector of a directory, 0 once past its end
+static sec_t dir_sector(u32 dirCluster, u32 index)
+{
+	if (dirCluster == 0)
+	{
+		if (geometry.fatBits == 32 || index >= geometry.rootDirSectors)
+			return 0;
+		return geometry.rootDirStart + index;
+	}
+	u32 cluster = dirCluster;
+	for (u32 skip = index / geometry.sectorsPerCluster; skip > 0 && cluster != 0; skip--)
+		cluster = fatraw_next_cluster(cluster);
+	if (cluster == 0)
+		return 0;
+	return fatraw_cluster_sector(cluster) + index % geometry.sectorsPerCluster;
+}
+
+// calls visit with every live short name entry of the directory at dirCluster
+// in order, 1 if visit stopped the walk, 0 at the end of the directory, -1 if
+// it couldn't be read
+typedef bool (*dir_visit_fn)(const u8 *entry, sec_t sector, u32 offset, void *ctx);
+
+static int walk_dir(u32 dirCluster, dir_visit_fn visit, void *ctx)
+{
+	for (u32 index = 0;; index++)
+	{
+		sec_t current = dir_sector(dirCluster, index);
+		if (current == 0)
+			return 0;
+		if (!fat_disc->readSectors(current, 1, sector_buf))
+			return -1;
+		for (u32 pos = 0; pos < SECTOR_SIZE; pos += DIR_ENTRY_SIZE)
+		{
+			const u8 *candidate = sector_buf + pos;
+			if (candidate[0] == 0)
+				return 0; // end of the directory
+			if (candidate[0] == 0xE5 || (candidate[DIR_ATTR] & 0x0F) == 0x0F)
+				continue; // deleted or long name
+			if (!visit(candidate, current, pos, ctx))
+				return 1;
+		}
+	}
+}
+
+static bool fill_visit(const u8 *entry, sec_t sector, u32 offset, void *ctx)
+{
+	dir_cache_dir *dir = (dir_cache_dir*)ctx;
+	if (dir->count == DIR_CACHE_ENTRIES)
+		return false;
+	dir_cache_entry *slot = &dir->entries[dir->count++];
+	memcpy(slot->raw, entry, DIR_ENTRY_SIZE);
+	slot->sector = sector;
+	slot->offset = offset;
+	return true;
+}
+
+// the cached entries of a directory, read in on the first use and replacing
+// the one used longest ago, 0 if it can't be read
+static dir_cache_dir *cached_dir(u32 dirCluster)
+{
+	dir_cache_dir *victim = &dir_cache[0];
+	for (u32 i = 0; i < DIR_CACHE_DIRS; i++)
+	{
+		dir_cache_dir *dir = &dir_cache[i];
+		if (dir->valid && dir->cluster == dirCluster)
+		{
+			dir->lastUse = ++dir_cache_clock;
+			return dir;
+		}
+		if (victim->valid && (!dir->valid || dir->lastUse < victim->lastUse))
+			victim = dir;
+	}
+
+	victim->valid = false;
+	victim->count = 0;
+	int walked = walk_dir(dirCluster, fill_visit, victim);
+	if (walked < 0)
+		return 0;
+	victim->valid = true;
+	victim->complete = walked == 0;
+	victim->cluster = dirCluster;
+	victim->lastUse = ++dir_cache_clock;
+	return victim;
+}
+
+typedef struct {
+	const char *shortName;
+	sec_t *sector;
+	u32 *offset;
+	u8 *entry;
+} find_state;
+
+static bool find_visit(const u8 *entry, sec_t sector, u32 offset, void *ctx)
+{
+	find_state *state = (find_state*)ctx;
+	if (memcmp(entry, state->shortName, 11) != 0)
+		return true;
+	*state->sector = sector;
+	*state->offset = offset;
+	memcpy(state->entry, entry, DIR_ENTRY_SIZE);
+	return false;
+}
+
+// finds shortName in the directory starting at dirCluster, 0 being the fat16 root
+static bool find_in_dir(u32 dirCluster, const char shortName[11], sec_t *sector, u32 *offset, u8 *entry)
+{
+	find_state state = { shortName, sector, offset, entry };
+	dir_cache_dir *dir = cached_dir(dirCluster);
+	if (dir == 0)
+		return false;
+	if (!dir->complete)
+		return walk_dir(dirCluster, find_visit, &state) == 1;
+
+	for (u32 i = 0; i < dir->count; i++)
+	{
+		if (!find_visit(dir->entries[i].raw, dir->entries[i].sector, dir->entries[i].offset, &state))
+			return true;
+	}
+	return false;
+}
+
+bool fatraw_locate_entry(const char *path, sec_t *sector, u32 *offset, u8 *entry)
+{
+	char component[MAX_PATH_LEN];
+	char shortName[11];
+
+	if (fat_disc == 0)
+		return false;
+
+	// a device prefix like nand: is allowed, the walk always starts at the root
+	const char *colon = strchr(path, ':');
+	if (colon)
+		path = colon + 1;
+
+	// the fixed fat12/16 root, there's no fat32 on the nand
+	u32 dirCluster = 0;
+	while (*path == '/')
+		path++;
+	while (*path)
+	{
+		const char *next = strchr(path, '/');
+		size_t len = next ? (size_t)(next - path) : strlen(path);
+		if (len >= sizeof(component))
+			return false;
+		memcpy(component, path, len);
+		component[len] = 0;
+		if (!to_short_name(component, shortName) || !find_in_dir(dirCluster, shortName, sector, offset, entry))
+			return false;
+
+		path += len;
+		while (*path == '/')
+			path++;
+		if (*path == 0)
+			return true;
+		if ((entry[DIR_ATTR] & FATRAW_ATTR_DIRECTORY) == 0)
+			return false;
+		dirCluster = get16(entry + DIR_CLUSTER_LOW) | (get16(entry + DIR_CLUSTER_HIGH) << 16);
+	}
+	return false;
+}
+
+typedef struct {
+	fatraw_dir_fn fn;
+	void *user;
+} list_state;
+
+static bool list_visit(const u8 *entry, sec_t sector, u32 offset, void *ctx)
+{
+	(void)sector;
+	(void)offset;
+	list_state *state = (list_state*)ctx;
+	if (entry[0] == '.' || (entry[DIR_ATTR] & 0x08))
+		return true; // . and .. or the volume label
+	return state->fn((const char*)entry, entry[DIR_ATTR], get32(entry + DIR_FILE_SIZE), state->user);
+}
+
+bool fatraw_list_dir(const char *path, fatraw_dir_fn fn, void *user)
+{
+	if (fat_disc == 0)
+		return false;
+
+	const char *colon = strchr(path, ':');
+	const char *rest = colon ? colon + 1 : path;
+	while (*rest == '/')
+		rest++;
+
+	u32 dirCluster = 0;
+	if (*rest)
+	{
+		sec_t sector;
+		u32 offset;
+		u8 entry[DIR_ENTRY_SIZE];
+		if (!fatraw_locate_entry(path, &sector, &offset, entry) || (entry[DIR_ATTR] & FATRAW_ATTR_DIRECTORY) == 0)
+			return false;
+		dirCluster = get16(entry + DIR_CLUSTER_LOW) | (get16(entry + DIR_CLUSTER_HIGH) << 16);
+	}
+
+	list_state state = { fn, user };
+	dir_cache_dir *dir = cached_dir(dirCluster);
+	if (dir == 0)
+		return false;
+	if (!dir->complete)
+		return walk_dir(dirCluster, list_visit, &state) >= 0;
+
+	for (u32 i = 0; i < dir->count; i++)
+	{
+		if (!list_visit(dir->entries[i].raw, dir->entries[i].sector, dir->entries[i].offset, &state))
+			break;
+	}
+	return true;
+}
+
+static bool update_entry(sec_t sector, u32 offset, const u8 *entry)
+{
+	if (!fat_disc->readSectors(sector, 1, sector_buf))
+		return false;
+	memcpy(sector_buf + offset, entry, DIR_ENTRY_SIZE);
+	return write_sector(sector, sector_buf);
+}
+
+fatraw_rewrite_result fatraw_rewrite_file(const char *path, const void *data, u32 size)
+{
+	sec_t entrySector;
+	u32 entryOffset;
+	u8 entry[DIR_ENTRY_SIZE];
+
+	if (size == 0 || !fatraw_locate_entry(path, &entrySector, &entryOffset, entry))
+		return FATRAW_REWRITE_UNSUPPORTED;
+
+	u32 clusterBytes = geometry.sectorsPerCluster * SECTOR_SIZE;
+	u32 oldSize = get32(entry + DIR_FILE_SIZE);
+	u32 cluster = get16(entry + DIR_CLUSTER_LOW) | (get16(entry + DIR_CLUSTER_HIGH) << 16);
+	u32 clustersNeeded = (size + clusterBytes - 1) / clusterBytes;
+
+	// a shorter chain can't hold the data, a longer one gets cut down after
+	if (cluster < 2 || (oldSize + clusterBytes - 1) / clusterBytes < clustersNeeded)
+		return FATRAW_REWRITE_UNSUPPORTED;
+
+	// resolve the whole chain before writing anything
+	u32 chain[clustersNeeded];
+	chain[0] = cluster;
+	for (u32 i = 1; i < clustersNeeded; i++)
+	{
+		chain[i] = fatraw_next_cluster(chain[i - 1]);
+		if (chain[i] == 0)
+			return FATRAW_REWRITE_UNSUPPORTED;
+	}
+	// fat12 entries can't be written, so there must be nothing to cut off
+	u32 surplus = fatraw_next_cluster(chain[clustersNeeded - 1]);
+	if (surplus != 0 && geometry.fatBits == 12)
+		return FATRAW_REWRITE_UNSUPPORTED;
+
+	// from here on a failure leaves the file half written
+	const u8 *src = (const u8*)data;
+	u32 sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	for (u32 i = 0; i < sectors; i++)
+	{
+		u32 chunk = size - i * SECTOR_SIZE;
+		if (chunk > SECTOR_SIZE)
+			chunk = SECTOR_SIZE;
+		memcpy(sector_buf, src + i * SECTOR_SIZE, chunk);
+		memset(sector_buf + chunk, 0, SECTOR_SIZE - chunk);
+		sec_t sector = fatraw_cluster_sector(chain[i / geometry.sectorsPerCluster]) + i % geometry.sectorsPerCluster;
+		if (!write_sector(sector, sector_buf))
+			return FATRAW_REWRITE_FAILED;
+	}
+
+	// whatever went past the data is dropped from the chain before the entry
+	// is updated, so a failure there is reported instead of leaking clusters
+	if (surplus != 0)
+	{
+		if (!set_fat_entry(chain[clustersNeeded - 1], FAT_END_OF_CHAIN))
+			return FATRAW_REWRITE_FAILED;
+		while (surplus != 0)
+		{
+			u32 next = fatraw_next_cluster(surplus);
+			if (!set_fat_entry(surplus, 0))
+				return FATRAW_REWRITE_FAILED;
+			surplus = next;
+		}
+	}
+
+	put32(entry + DIR_FILE_SIZE, size);
+	entry[DIR_ATTR] &= ~FATRAW_ATTR_READONLY;
+	if (!update_entry(entrySector, entryOffset, entry))
+		return FATRAW_REWRITE_FAILED;
+	return FATRAW_REWRITE_OK;
+}
+
+bool fatraw_set_attributes(const char *path, u8 set, u8 clear)
+{
+	sec_t entrySector;
+	u32 entryOffset;
+	u8 entry[DIR_ENTRY_SIZE];
+
+	if (!fatraw_locate_entry(path, &entrySector, &entryOffset, entry))
+		return false;
+
+	u8 attr = (entry[DIR_ATTR] & ~clear) | set;
+	if (attr == entry[DIR_ATTR])
+		return true;
+	entry[DIR_ATTR] = attr;
+	return update_entry(entrySector, entryOffset, entry);
+}
+
+bool fatraw_file_runs(const char *path, fatraw_run_fn fn, void *user, u32 *size)
+{
+	sec_t entrySector;
+	u32 entryOffset;
+	u8 entry[DIR_ENTRY_SIZE];
+
+	if (!fatraw_locate_entry(path, &entrySector, &entryOffset, entry)
+		|| (entry[DIR_ATTR] & FATRAW_ATTR_DIRECTORY))
+		return false;
+
+	u32 remaining = get32(entry + DIR_FILE_SIZE);
+	u32 cluster = get16(entry + DIR_CLUSTER_LOW) | (get16(entry + DIR_CLUSTER_HIGH) << 16);
+	u32 clusterBytes = geometry.sectorsPerCluster * SECTOR_SIZE;
+	if (size)
+		*size = remaining;
+
+	while (remaining > 0)
+	{
+		if (cluster < 2)
+			return false;
+
+		// extend the run while the chain stays contiguous
+		u32 first = cluster;
+		u32 count = 1;
+		u32 next = fatraw_next_cluster(cluster);
+		while ((u64)count * clusterBytes < remaining && next == cluster + 1)
+		{
+			cluster = next;
+			count++;
+			next = fatraw_next_cluster(cluster);
+		}
+
+		u32 bytes = count * clusterBytes;
+		if (bytes > remaining)
+			bytes = remaining;
+		sec_t sectors = (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+		if (!fn(fatraw_cluster_sector(first), sectors, bytes, user))
+			return false;
+
+		remaining -= bytes;
+		cluster = next;
+	}
+	return true;
+}
+
+u32 fatraw_touched_sectors(const sec_t **sectors)
+{
+	*sectors = touched;
+	return touched_count;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <nds/disc_io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/************************ Constants / Defines *********************************/
+
+// sectors remembered by fatraw_touched_sectors
+#define FATRAW_MAX_TOUCHED    16
+
+#define FATRAW_ATTR_READONLY  0x01
+#define FATRAW_ATTR_DIRECTORY 0x10
+
+// layout of the fat partition, all sectors are absolute on the device
+typedef struct {
+	uint32_t partitionStart;
+	uint32_t sectorsPerCluster;
+	uint32_t fatStart;
+	uint32_t sectorsPerFat;
+	uint32_t numFats;
+	uint32_t rootDirStart;
+	uint32_t rootDirSectors;
+	uint32_t dataStart;
+	uint32_t clusterCount;
+	uint32_t fatBits;
+} fatraw_geometry;
+
+/************************ Function Protoypes **********************************/
+
+// reads the mbr and boot sector of the first partition through disc
+bool fatraw_init(const DISC_INTERFACE *disc);
+// same, with a geometry worked out earlier, nothing is read
+bool fatraw_init_geometry(const DISC_INTERFACE *disc, const fatraw_geometry *known);
+// fills out from a decrypted boot sector, fails on anything but 512 byte sectors
+bool fatraw_parse_boot_sector(const uint8_t *bootSector, uint32_t partitionStart, fatraw_geometry *out);
+const fatraw_geometry *fatraw_get_geometry();
+
+// 0 once the chain ends (or is broken)
+uint32_t fatraw_next_cluster(uint32_t cluster);
+sec_t fatraw_cluster_sector(uint32_t cluster);
+
+// walks path from the root directory, a device prefix like nand: is skipped
+// only plain 8.3 names are supported
+bool fatraw_locate_entry(const char *path, sec_t *sector, uint32_t *offset, uint8_t *entry);
+
+// hands fn every file and directory (no . and .., no volume label) with its
+// space padded, unterminated 8.3 name, fn returns false to stop early. the
+// entries of recently used directories are kept in memory, so repeated
+// lookups and listings of them don't touch the nand
+typedef bool (*fatraw_dir_fn)(const char shortName[11], uint8_t attr, uint32_t size, void *user);
+bool fatraw_list_dir(const char *path, fatraw_dir_fn fn, void *user);
+
+// drops the cached directory entries, for when the nand was written around fatraw
+void fatraw_dir_cache_invalidate();
+
+typedef enum {
+	FATRAW_REWRITE_UNSUPPORTED, // nothing was written, the file needs another way
+	FATRAW_REWRITE_OK,
+	FATRAW_REWRITE_FAILED,      // written partway, the file is in an unknown state
+} fatraw_rewrite_result;
+
+// overwrites a file in place through its existing cluster chain, frees the
+// clusters past the new size in the first fat and then updates its directory
+// entry (size, read only flag cleared). the other fat copies are the caller's
+// to sync once this succeeded, on failure they still describe the old file.
+// unsupported without touching anything if the chain is too short for size or
+// a fat12 one would have to be cut
+fatraw_rewrite_result fatraw_rewrite_file(const char *path, const void *data, uint32_t size);
+bool fatraw_set_attributes(const char *path, uint8_t set, uint8_t clear);
+
+// gets a run of consecutive sectors of a file and how many of its bytes are
+// file data, only the last run can end in the middle of a sector
+typedef bool (*fatraw_run_fn)(sec_t start, sec_t len, uint32_t bytes, void *user);
+
+// walks the cluster chain of a file and passes it to fn as runs of
+// contiguous clusters, cut down to the file's size. fails if the chain is
+// shorter than the size or fn returns false
+bool fatraw_file_runs(const char *path, fatraw_run_fn fn, void *user, uint32_t *size);
+
+// every sector written since fatraw_init, returns how many there were
+uint32_t fatraw_touched_sectors(const sec_t **sectors);
+
+#ifdef __cplusplus
+}
+#endif
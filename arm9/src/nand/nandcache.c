@@ -0,0 +1,256 @@
+#include <nds.h>
+#include <string.h>
+#include "sector0.h"
+#include "../arena.h"
+#include "nandcache.h"
+
+/************************ Structures / Datatypes ******************************/
+
+typedef struct {
+	sec_t sector;
+	uint32_t lastUse;
+	uint32_t writeSeq; // the write request it was last dirtied by
+	bool valid;
+	bool dirty;
+} cache_entry_t;
+
+/************************ Globals *********************************************/
+
+static cache_entry_t *entries = 0;
+static u8 *cache_data = 0;
+static uint32_t entryCount = 0;
+static uint32_t useCounter = 0;
+static uint32_t writeCounter = 0;
+
+static nandcache_read_fn device_read = 0;
+static nandcache_write_fn device_write = 0;
+
+/************************ Functions *******************************************/
+
+static inline u8 *entry_data(uint32_t index)
+{
+	return cache_data + index * SECTOR_SIZE;
+}
+
+static int find_entry(sec_t sector)
+{
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		if (entries[i].valid && entries[i].sector == sector)
+			return i;
+	}
+	return -1;
+}
+
+static bool write_back(uint32_t index)
+{
+	if (!entries[index].dirty)
+		return true;
+	if (!device_write(entries[index].sector, 1, entry_data(index)))
+		return false;
+	entries[index].dirty = false;
+	return true;
+}
+
+// writes back the dirty sectors of every request up to until in the order
+// they came in, leaving start..start+len behind
+static bool write_back_until(uint32_t until, sec_t start, sec_t len)
+{
+	while (true)
+	{
+		int next = -1;
+		for (uint32_t i = 0; i < entryCount; i++)
+		{
+			if (!entries[i].dirty || entries[i].writeSeq > until
+				|| (entries[i].sector >= start && entries[i].sector < start + len))
+				continue;
+			if (next < 0 || entries[i].writeSeq < entries[next].writeSeq
+				|| (entries[i].writeSeq == entries[next].writeSeq && entries[i].sector < entries[next].sector))
+				next = i;
+		}
+		if (next < 0)
+			return true;
+		if (!write_back(next))
+			return false;
+	}
+}
+
+// least recently used slot, evicting (and writing back) what was there. a
+// dirty victim takes everything written before it along
+static int claim_entry(sec_t sector)
+{
+	uint32_t victim = 0;
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		if (!entries[i].valid)
+		{
+			victim = i;
+			break;
+		}
+		if (entries[i].lastUse < entries[victim].lastUse)
+			victim = i;
+	}
+
+	if (entries[victim].dirty && !write_back_until(entries[victim].writeSeq, 0, 0))
+		return -1;
+
+	entries[victim].sector = sector;
+	entries[victim].valid = true;
+	entries[victim].dirty = false;
+	entries[victim].lastUse = ++useCounter;
+	return victim;
+}
+
+bool nandcache_init(uint32_t sectors, nandcache_read_fn read, nandcache_write_fn write)
+{
+	nandcache_deinit();
+
+	device_read = read;
+	device_write = write;
+
+	if (sectors == 0)
+		return true;
+
+	entries = (cache_entry_t*)arenaAllocPersistent(sectors * sizeof(cache_entry_t));
+	cache_data = (u8*)arenaAllocPersistent(sectors * SECTOR_SIZE);
+	if (entries == 0 || cache_data == 0)
+	{
+		nandcache_deinit();
+		return false;
+	}
+	memset(entries, 0, sectors * sizeof(cache_entry_t));
+
+	entryCount = sectors;
+	useCounter = 0;
+	writeCounter = 0;
+	return true;
+}
+
+uint32_t nandcache_arena_size(uint32_t sectors)
+{
+	// both allocations are rounded up to whole cache lines
+	return sectors == 0 ? 0 : sectors * (sizeof(cache_entry_t) + SECTOR_SIZE) + 2 * ARENA_ALIGN;
+}
+
+// the memory itself goes back with the arena reset of whoever mounted
+void nandcache_deinit()
+{
+	entries = 0;
+	cache_data = 0;
+	entryCount = 0;
+}
+
+bool nandcache_read(sec_t start, sec_t len, void *buffer)
+{
+	u8 *out = (u8*)buffer;
+
+	if (entryCount == 0)
+		return device_read(start, len, buffer);
+
+	if (len > NAND_CACHE_MAX_REQUEST)
+	{
+		if (!device_read(start, len, buffer))
+			return false;
+		// what's on the device is stale for anything not written back yet
+		for (uint32_t i = 0; i < entryCount; i++)
+		{
+			if (entries[i].dirty && entries[i].sector >= start && entries[i].sector < start + len)
+				memcpy(out + (entries[i].sector - start) * SECTOR_SIZE, entry_data(i), SECTOR_SIZE);
+		}
+		return true;
+	}
+
+	sec_t i = 0;
+	while (i < len)
+	{
+		int hit = find_entry(start + i);
+		if (hit >= 0)
+		{
+			memcpy(out + i * SECTOR_SIZE, entry_data(hit), SECTOR_SIZE);
+			entries[hit].lastUse = ++useCounter;
+			i++;
+			continue;
+		}
+
+		// fetch the whole run of missing sectors with a single request
+		sec_t run = 1;
+		while (i + run < len && find_entry(start + i + run) < 0)
+			run++;
+
+		if (!device_read(start + i, run, out + i * SECTOR_SIZE))
+			return false;
+
+		for (sec_t j = 0; j < run; j++)
+		{
+			int slot = claim_entry(start + i + j);
+			if (slot < 0)
+				return false;
+			memcpy(entry_data(slot), out + (i + j) * SECTOR_SIZE, SECTOR_SIZE);
+		}
+		i += run;
+	}
+	return true;
+}
+
+bool nandcache_write(sec_t start, sec_t len, const void *buffer)
+{
+	const u8 *in = (const u8*)buffer;
+
+	if (entryCount == 0)
+		return device_write(start, len, buffer);
+
+	if (len > NAND_CACHE_MAX_REQUEST)
+	{
+		// everything before it has to be on the device first
+		if (!write_back_until(writeCounter, 0, 0) || !device_write(start, len, buffer))
+			return false;
+		// keep cached copies in sync, they are now clean
+		for (uint32_t i = 0; i < entryCount; i++)
+		{
+			if (entries[i].valid && entries[i].sector >= start && entries[i].sector < start + len)
+			{
+				memcpy(entry_data(i), in + (entries[i].sector - start) * SECTOR_SIZE, SECTOR_SIZE);
+				entries[i].dirty = false;
+			}
+		}
+		return true;
+	}
+
+	// a sector still dirty from an older request would jump ahead of what was
+	// written since once it's overwritten, so that goes out first. the last
+	// request can just be written over
+	uint32_t until = 0;
+	for (sec_t i = 0; i < len; i++)
+	{
+		int slot = find_entry(start + i);
+		if (slot >= 0 && entries[slot].dirty && entries[slot].writeSeq != writeCounter && entries[slot].writeSeq > until)
+			until = entries[slot].writeSeq;
+	}
+	if (until != 0 && !write_back_until(until, 0, 0))
+		return false;
+
+	uint32_t seq = ++writeCounter;
+	for (sec_t i = 0; i < len; i++)
+	{
+		int slot = find_entry(start + i);
+		if (slot < 0)
+			slot = claim_entry(start + i);
+		if (slot < 0)
+			return false;
+		memcpy(entry_data(slot), in + i * SECTOR_SIZE, SECTOR_SIZE);
+		entries[slot].dirty = true;
+		entries[slot].writeSeq = seq;
+		entries[slot].lastUse = ++useCounter;
+	}
+	return true;
+}
+
+bool nandcache_flush()
+{
+	return nandcache_flush_outside(0, 0);
+}
+
+bool nandcache_flush_outside(sec_t start, sec_t len)
+{
+	return write_back_until(writeCounter, start, len);
+}
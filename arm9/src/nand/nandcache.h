@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <nds/disc_io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/************************ Constants / Defines *********************************/
+
+// decrypted sectors kept around, 0 turns the cache into a pass through
+#define NAND_CACHE_SECTORS    64
+// requests bigger than this go straight to the device
+#define NAND_CACHE_MAX_REQUEST 8
+
+typedef bool (*nandcache_read_fn)(sec_t start, sec_t len, void *buffer);
+typedef bool (*nandcache_write_fn)(sec_t start, sec_t len, const void *buffer);
+
+/************************ Function Protoypes **********************************/
+
+bool nandcache_init(uint32_t sectors, nandcache_read_fn read, nandcache_write_fn write);
+// arena bytes nandcache_init takes for a cache of that many sectors
+uint32_t nandcache_arena_size(uint32_t sectors);
+void nandcache_deinit();
+
+bool nandcache_read(sec_t start, sec_t len, void *buffer);
+// dirty sectors go to the device in the order their write requests came in,
+// one request only after all those before it. whenever power is lost the
+// device holds what write through would have left (up to a request torn in
+// the middle), a fat or directory update never lands before the data it
+// points to. the one exception are the sectors nandcache_flush_outside
+// leaves behind, they land after everything written later
+bool nandcache_write(sec_t start, sec_t len, const void *buffer);
+
+// write back every dirty sector, in the order they were written
+bool nandcache_flush();
+// same, leaving the dirty sectors in start..start+len behind
+bool nandcache_flush_outside(sec_t start, sec_t len);
+
+#ifdef __cplusplus
+}
+#endif
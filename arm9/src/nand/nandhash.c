@@ -0,0 +1,55 @@
+#include <nds.h>
+#include "sector0.h"
+#include "fatraw.h"
+#include "nandio.h"
+#include "nandhash.h"
+#include "../profile.h"
+
+/************************ Structures / Datatypes ******************************/
+
+typedef struct {
+	swiSHA1context_t ctx;
+	u32 runBytes; // file bytes left in the run being streamed
+} hash_state_t;
+
+/************************ Functions *******************************************/
+
+static bool hash_chunk(const void *data, sec_t len, void *user)
+{
+	hash_state_t *state = (hash_state_t*)user;
+	u32 bytes = len * SECTOR_SIZE;
+	if (bytes > state->runBytes)
+		bytes = state->runBytes;
+	swiSHA1Update(&state->ctx, data, bytes);
+	state->runBytes -= bytes;
+	return true;
+}
+
+static bool hash_run(sec_t start, sec_t len, u32 bytes, void *user)
+{
+	hash_state_t *state = (hash_state_t*)user;
+	state->runBytes = bytes;
+	return nandio_stream_sectors(start, len, hash_chunk, user);
+}
+
+bool nandhash_sha1_file(const char *path, void *digest, u32 *size)
+{
+	if (!fatraw_init_geometry(&io_dsi_nand, &nandio_get_info()->fat))
+		return false;
+
+	u32 timing = profileStart();
+	hash_state_t state;
+	state.ctx.sha_block = 0; //this is weird but it has to be done
+	swiSHA1Init(&state.ctx);
+
+	u32 fileSize = 0;
+	bool ok = fatraw_file_runs(path, hash_run, &state, &fileSize);
+	profileStop(PROFILE_SHA1, timing, ok ? fileSize : 0, (fileSize + SECTOR_SIZE - 1) / SECTOR_SIZE);
+	if (!ok)
+		return false;
+
+	swiSHA1Final(digest, &state.ctx);
+	if (size)
+		*size = fileSize;
+	return true;
+}
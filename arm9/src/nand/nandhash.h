@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/************************ Function Protoypes **********************************/
+
+// sha1 of a file on the mounted nand, read cluster run by cluster run past
+// libfat and hashed straight out of the decrypt buffer. the file has to be
+// closed in libfat so its cache doesn't hold anything newer.
+// only plain 8.3 paths, see fatraw_locate_entry
+bool nandhash_sha1_file(const char *path, void *digest, uint32_t *size);
+
+#ifdef __cplusplus
+}
+#endif
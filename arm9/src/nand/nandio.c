@@ -1,23 +1,37 @@
 
 #include <nds.h>
 #include <nds/disc_io.h>
-#include <malloc.h>
 #include <stdio.h>
 #include "crypto.h"
 #include "sector0.h"
 #include "f_xy.h"
 #include "../message.h"
+#include "../profile.h"
+#include "../arena.h"
 #include "nandio.h"
+#include "nandcache.h"
+#include "nandqueue.h"
+#include "sdmmc_queue.h"
 #include "u128_math.h"
 
 /************************ Function Protoypes **********************************/
 
 static bool nandio_startup();
+static bool nandio_startup_readonly();
 static bool nandio_is_inserted();
 static bool nandio_read_sectors(sec_t offset, sec_t len, void *buffer);
+static bool nandio_read_sectors_readonly(sec_t offset, sec_t len, void *buffer);
 static bool nandio_write_sectors(sec_t offset, sec_t len, const void *buffer);
+static bool nandio_write_sectors_readonly(sec_t offset, sec_t len, const void *buffer);
+static bool device_read_sectors(sec_t offset, sec_t len, void *buffer);
+static bool device_write_sectors(sec_t offset, sec_t len, const void *buffer);
+static bool read_sectors(sec_t start, sec_t len, void *buffer);
+static void decrypt_sectors(sec_t start, sec_t len, void *buffer, const u8 *src);
+static bool arm7_decrypt_read(sec_t start, sec_t len, void *buffer);
+static bool arm7_encrypt_write(sec_t start, sec_t len, void *buffer);
 static bool nandio_clear_status();
 bool nandio_shutdown();
+static bool nandio_shutdown_readonly();
 
 /************************ Constants / Defines *********************************/
 
@@ -32,19 +46,64 @@ const DISC_INTERFACE io_dsi_nand = {
 	nandio_shutdown
 };
 
+const DISC_INTERFACE io_dsi_nand_readonly = {
+	NAND_DEVICENAME,
+	FEATURE_MEDIUM_CANREAD,
+	nandio_startup_readonly,
+	nandio_is_inserted,
+	nandio_read_sectors_readonly,
+	nandio_write_sectors_readonly,
+	nandio_clear_status,
+	nandio_shutdown_readonly
+};
+
 bool is3DS;
 
 static bool writingLocked = true;
 static bool nandWritten = false;
+// set by nandio_hold_fat_copies, the copies aren't synced for the rest of the mount
+static bool fatCopiesHeld = false;
 
 extern bool nand_Startup();
 
 static u8* crypt_buf = 0;
+// second slot for pipelined reads, the next chunk lands here while the
+// current one is being decrypted
+static u8* crypt_buf_next = 0;
+
+static u32 cache_sectors = NAND_CACHE_SECTORS;
+
+// sectors per transfer and size of each crypt buffer, picked from free memory
+// at startup unless nandio_set_transfer_size asked for something specific
+static u32 xfer_request = 0;
+static u32 xfer_sectors = CRYPT_BUF_LEN;
 
 static u32 fat_sig_fix_offset = 0;
+// the sector decrypt_sectors patches, 0 on a read-only mount where the patched
+// boot sector is kept aside instead
+static u32 sig_fix_sector = 0;
+
+// set for the length of an io_dsi_nand_readonly mount
+static bool read_only = false;
+static u8 *boot_sector = 0;
+
+// primary FAT copy and the sectors of it written since the last sync
+static u32 fat_start = 0;
+static u32 fat_sectors = 0;
+static u32 *fat_dirty = 0;
+
+static u8 *sector_buf = 0;
 
-static u32 sector_buf32[SECTOR_SIZE/sizeof(u32)];
-static u8 *sector_buf = (u8*)sector_buf32;
+// every buffer of a mount comes from the persistent end of the arena and is
+// given back in one go when it ends
+static ArenaMark mount_mark;
+
+static nandio_info_t info;
+// the crypto backends only have to be tested once
+static bool backends_probed = false;
+// the ARM7 decrypts/encrypts sectors as part of the transfer, the ARM9 never
+// touches the nand crypt at all
+static bool arm7_crypt = false;
 
 void nandio_set_fat_sig_fix(u32 offset)
 {
@@ -88,46 +147,224 @@ void getConsoleID(u8 *consoleID)
 	memcpy(&consoleID[4], &key_x[0xC], 4);
 }
 
-static bool nandio_startup()
+// the largest power of two up to NAND_XFER_MAX_SECTORS for which both crypt
+// buffers, the fat sync's run buffer of the same size and the cache all fit
+// in what's left in the arena
+static u32 pick_transfer_size()
 {
-	if (!nand_Startup())
+	if (xfer_request != 0)
 	{
-		return false;
+		return xfer_request;
+	}
+	u32 available = arenaAvailable();
+	u32 cache = nandcache_arena_size(cache_sectors);
+	u32 budget = available > cache ? (available - cache) / 3 / SECTOR_SIZE : 0;
+	u32 sectors = CRYPT_BUF_LEN;
+	while (sectors * 2 <= NAND_XFER_MAX_SECTORS && sectors * 2 <= budget)
+	{
+		sectors *= 2;
+	}
+	return sectors;
+}
+
+// the cache and the queue sit above mount_mark as well
+static void release_buffers()
+{
+	nandcache_deinit();
+	nandqueue_deinit();
+	arenaPersistentReset(mount_mark);
+	fat_dirty = 0;
+	boot_sector = 0;
+	crypt_buf = 0;
+	crypt_buf_next = 0;
+	sector_buf = 0;
+}
+
+#define ES_PROBE_SIZE 0x40
+
+static bool es_probe_pattern(const u8* buf)
+{
+	for (int i = 0; i < ES_PROBE_SIZE; i++)
+	{
+		if (buf[i] != (u8)i)
+			return false;
 	}
+	return true;
+}
+
+// uses crypt_buf as scratch
+static bool es_hardware_works()
+{
+	for (int i = 0; i < ES_PROBE_SIZE; i++)
+		crypt_buf[i] = i;
+
+	dsi_es_crypt_set_backend(CRYPT_BACKEND_SOFTWARE);
+	dsi_es_block_crypt(crypt_buf, ES_PROBE_SIZE + 0x20, ENCRYPT);
+	dsi_es_crypt_set_backend(CRYPT_BACKEND_HARDWARE);
+	if (dsi_es_block_crypt(crypt_buf, ES_PROBE_SIZE + 0x20, DECRYPT) != 0 || !es_probe_pattern(crypt_buf))
+		return false;
+
+	dsi_es_block_crypt(crypt_buf, ES_PROBE_SIZE + 0x20, ENCRYPT);
+	dsi_es_crypt_set_backend(CRYPT_BACKEND_SOFTWARE);
+	return dsi_es_block_crypt(crypt_buf, ES_PROBE_SIZE + 0x20, DECRYPT) == 0 && es_probe_pattern(crypt_buf);
+}
+
+// everything that only has to be worked out once: keys, partition table and
+// the bpb of the first partition, crypt_buf is used as scratch
+static bool probe_nand()
+{
+	memset(&info, 0, sizeof(info));
 
 	nand_ReadSectors(0, 1, sector_buf);
 	is3DS = parse_ncsd(sector_buf) == 0;
 	if (is3DS) return false;
 
 	u8 consoleID[8];
-	u8 consoleIDfixed[8];
-	u8 CID[16];
 
 	// Get ConsoleID
 	getConsoleID(consoleID);
 	for (int i = 0; i < 8; i++)
 	{
-		consoleIDfixed[i] = consoleID[7-i];
+		info.consoleId[i] = consoleID[7-i];
 	}
 	
-	getCID(CID);
+	getCID(info.cid);
 	
 	// iprintf("sector 0 is %s\n", is3DS ? "3DS" : "DSi");
-	dsi_crypt_init((const u8*)consoleIDfixed, (const u8*)CID, is3DS);
+	dsi_crypt_init(info.consoleId, info.cid, is3DS);
 	dsi_nand_crypt(sector_buf, sector_buf, 0, SECTOR_SIZE / AES_BLOCK_SIZE);
 
 	parse_mbr(sector_buf, is3DS);
 
 	mbr_t *mbr = (mbr_t*)sector_buf;
+	info.is3DS = is3DS;
+	info.partitionStart = mbr->partitions[0].offset;
+	info.partitionSectors = mbr->partitions[0].length;
 
-	nandio_set_fat_sig_fix(is3DS ? 0 : mbr->partitions[0].offset);
+	nandio_set_fat_sig_fix(is3DS ? 0 : info.partitionStart);
 
-	if (crypt_buf == 0)
+	// a bad bpb isn't fatal here, libfat will have its own say about it
+	if (nand_ReadSectors(info.partitionStart, 1, crypt_buf))
 	{
-		crypt_buf = (u8*)memalign(32, SECTOR_SIZE * CRYPT_BUF_LEN);
+		decrypt_sectors(info.partitionStart, 1, crypt_buf, crypt_buf);
+		fatraw_parse_boot_sector(crypt_buf, info.partitionStart, &info.fat);
 	}
 
-	return crypt_buf != 0;
+	info.valid = true;
+	return true;
+}
+
+static bool startup(bool readOnly)
+{
+	if (!nand_Startup())
+	{
+		return false;
+	}
+
+	// a repeated startup lays the buffers out again from scratch
+	if (crypt_buf != 0)
+	{
+		release_buffers();
+	}
+	mount_mark = arenaPersistentMark();
+	fatCopiesHeld = false;
+	// whatever fatraw remembers of the directories may be from another nand
+	fatraw_dir_cache_invalidate();
+
+	sector_buf = (u8*)arenaAllocPersistent(SECTOR_SIZE);
+	// halve the size until it fits, big transfers are nice but not required
+	xfer_sectors = pick_transfer_size();
+	while ((crypt_buf = (u8*)arenaAllocPersistent(SECTOR_SIZE * xfer_sectors)) == 0
+		&& xfer_sectors > CRYPT_BUF_LEN)
+	{
+		xfer_sectors /= 2;
+	}
+
+	if (sector_buf == 0 || crypt_buf == 0)
+	{
+		release_buffers();
+		return false;
+	}
+
+	// not fatal, large transfers just won't be pipelined
+	crypt_buf_next = (u8*)arenaAllocPersistent(SECTOR_SIZE * xfer_sectors);
+	nandqueue_init();
+
+	if (!info.valid && !probe_nand())
+	{
+		release_buffers();
+		return false;
+	}
+	read_only = readOnly;
+	sig_fix_sector = readOnly ? 0 : fat_sig_fix_offset;
+
+	if (!backends_probed)
+	{
+		// keyslot 3 should already hold the nand key, only switch to the AES engine
+		// if it decrypts sector 0 the same way as the key we derived
+		nand_ReadSectors(0, 1, sector_buf);
+		dsi_nand_crypt_set_backend(CRYPT_BACKEND_SOFTWARE);
+		dsi_nand_crypt(sector_buf, sector_buf, 0, SECTOR_SIZE / AES_BLOCK_SIZE);
+		if (nand_ReadSectors(0, 1, crypt_buf))
+		{
+			dsi_nand_crypt_set_backend(CRYPT_BACKEND_HARDWARE);
+			dsi_nand_crypt(crypt_buf, crypt_buf, 0, SECTOR_SIZE / AES_BLOCK_SIZE);
+			if (memcmp(crypt_buf, sector_buf, SECTOR_SIZE) != 0)
+			{
+				dsi_nand_crypt_set_backend(CRYPT_BACKEND_SOFTWARE);
+			}
+		}
+
+		// the engine works, let the ARM7 run it on the transfers themselves as
+		// long as its decrypting read agrees as well
+		arm7_crypt = nandio_hw_crypt() && nandqueue_ready()
+			&& arm7_decrypt_read(0, 1, crypt_buf)
+			&& memcmp(crypt_buf, sector_buf, SECTOR_SIZE) == 0;
+
+		// same for es blocks, the engine has to open one sealed in software and
+		// seal one that software can open
+		dsi_es_crypt_set_backend(es_hardware_works() ? CRYPT_BACKEND_HARDWARE : CRYPT_BACKEND_SOFTWARE);
+		backends_probed = true;
+	}
+
+	// remember where the primary FAT is, so writes to it can be tracked
+	if (info.fat.fatBits != 0 && !readOnly)
+	{
+		fat_start = info.fat.fatStart;
+		fat_sectors = info.fat.sectorsPerFat;
+		fat_dirty = (u32*)arenaAllocPersistent((fat_sectors + 31) / 32 * sizeof(u32));
+		if (fat_dirty)
+			memset(fat_dirty, 0, (fat_sectors + 31) / 32 * sizeof(u32));
+	}
+
+	return nandcache_init(cache_sectors, device_read_sectors, device_write_sectors);
+}
+
+static bool nandio_startup()
+{
+	return startup(false);
+}
+
+// nothing is tracked for writes, and the boot sector gets its signature fixed
+// once here instead of being checked for on every read
+static bool nandio_startup_readonly()
+{
+	if (!startup(true))
+		return false;
+
+	if (fat_sig_fix_offset)
+	{
+		boot_sector = (u8*)arenaAllocPersistent(SECTOR_SIZE);
+		if (boot_sector == 0 || !nandcache_read(fat_sig_fix_offset, 1, boot_sector))
+			return false;
+		if (boot_sector[0x36] == 0 && boot_sector[0x37] == 0 && boot_sector[0x38] == 0)
+		{
+			boot_sector[0x36] = 'F';
+			boot_sector[0x37] = 'A';
+			boot_sector[0x38] = 'T';
+		}
+	}
+	return true;
 }
 
 static bool nandio_is_inserted()
@@ -135,22 +372,82 @@ static bool nandio_is_inserted()
 	return true;
 }
 
-// len is guaranteed <= CRYPT_BUF_LEN
+// the stock nand transfers move raw sectors, these have the ARM7 crypt them.
+// they go through the ring as single requests, FIFO_SDMMC is left to libnds
+static bool arm7_decrypt_read(sec_t start, sec_t len, void *buffer)
+{
+	int ticket = nandqueue_decrypt_read(start, len, buffer);
+	if (ticket < 0)
+		return false;
+	nandqueue_kick();
+	return nandqueue_wait(ticket);
+}
+
+static bool arm7_encrypt_write(sec_t start, sec_t len, void *buffer)
+{
+	int ticket = nandqueue_encrypt_write(start, len, buffer);
+	if (ticket < 0)
+		return false;
+	nandqueue_kick();
+	return nandqueue_wait(ticket);
+}
+
+// the ARM7 can only reach main ram, whole cache lines keep the invalidate safe
+static bool arm7_can_reach(const void *buffer)
+{
+	return ((u32)buffer >> 24) == 0x02 && ((u32)buffer & 31) == 0;
+}
+
+// with arm7_crypt src already holds plaintext
+static void decrypt_sectors(sec_t start, sec_t len, void *buffer, const u8 *src)
+{
+	if (!arm7_crypt)
+		dsi_nand_crypt(buffer, src, start * SECTOR_SIZE / AES_BLOCK_SIZE, len * SECTOR_SIZE / AES_BLOCK_SIZE);
+	else if (buffer != src)
+		memcpy(buffer, src, len * SECTOR_SIZE);
+	if (sig_fix_sector &&
+		start == sig_fix_sector
+		&& ((u8*)buffer)[0x36] == 0
+		&& ((u8*)buffer)[0x37] == 0
+		&& ((u8*)buffer)[0x38] == 0)
+	{
+		((u8*)buffer)[0x36] = 'F';
+		((u8*)buffer)[0x37] = 'A';
+		((u8*)buffer)[0x38] = 'T';
+	}
+}
+
+// the ring variants of the transfers, crypting on the ARM7 whenever it can
+static int queue_read(sec_t start, sec_t len, void *buffer)
+{
+	return arm7_crypt ? nandqueue_decrypt_read(start, len, buffer) : nandqueue_read(start, len, buffer);
+}
+
+static int queue_write(sec_t start, sec_t len, void *buffer)
+{
+	return arm7_crypt ? nandqueue_encrypt_write(start, len, buffer) : nandqueue_write(start, len, buffer);
+}
+
+// len is guaranteed <= xfer_sectors
 static bool read_sectors(sec_t start, sec_t len, void *buffer)
 {
-	if (nand_ReadSectors(start, len, crypt_buf))
+	u32 timing = profileStart();
+	if (arm7_crypt && arm7_can_reach(buffer))
 	{
-		dsi_nand_crypt(buffer, crypt_buf, start * SECTOR_SIZE / AES_BLOCK_SIZE, len * SECTOR_SIZE / AES_BLOCK_SIZE);
-		if (fat_sig_fix_offset &&
-			start == fat_sig_fix_offset
-			&& ((u8*)buffer)[0x36] == 0
-			&& ((u8*)buffer)[0x37] == 0
-			&& ((u8*)buffer)[0x38] == 0)
-		{
-			((u8*)buffer)[0x36] = 'F';
-			((u8*)buffer)[0x37] = 'A';
-			((u8*)buffer)[0x38] = 'T';
-		}
+		// nothing left to do on this side but the signature fix
+		bool read = arm7_decrypt_read(start, len, buffer);
+		profileStop(PROFILE_NAND_READ, timing, len * SECTOR_SIZE, len);
+		if (read)
+			decrypt_sectors(start, len, buffer, buffer);
+		return read;
+	}
+	bool read = arm7_crypt
+		? arm7_decrypt_read(start, len, crypt_buf)
+		: nand_ReadSectors(start, len, crypt_buf);
+	profileStop(PROFILE_NAND_READ, timing, len * SECTOR_SIZE, len);
+	if (read)
+	{
+		decrypt_sectors(start, len, buffer, crypt_buf);
 		return true;
 	}
 	else
@@ -159,35 +456,202 @@ static bool read_sectors(sec_t start, sec_t len, void *buffer)
 	}
 }
 
-// len is guaranteed <= CRYPT_BUF_LEN
-static bool write_sectors(sec_t start, sec_t len, const void *buffer)
+// every chunk after the first is read by the ARM7 while the ARM9 decrypts the
+// previous one
+static bool read_sectors_pipelined(sec_t offset, sec_t len, void *buffer)
 {
-	static u8 writeCopy[SECTOR_SIZE*CRYPT_BUF_LEN];
-	memcpy(writeCopy, buffer, len * SECTOR_SIZE);
+	u8 *slots[2] = { crypt_buf, crypt_buf_next };
+	int slot = 0;
+	sec_t chunk = len < xfer_sectors ? len : xfer_sectors;
 
-	dsi_nand_crypt(crypt_buf, writeCopy, start * SECTOR_SIZE / AES_BLOCK_SIZE, len * SECTOR_SIZE / AES_BLOCK_SIZE);
-	if (nand_WriteSectors(start, len, crypt_buf))
+	int ticket = queue_read(offset, chunk, slots[slot]);
+	if (ticket < 0)
 	{
-		return true;
+		return false;
 	}
-	else
+	nandqueue_kick();
+
+	while (len > 0)
 	{
-		return false;
+		if (!nandqueue_wait(ticket))
+		{
+			return false;
+		}
+
+		sec_t next = len - chunk;
+		if (next > xfer_sectors)
+			next = xfer_sectors;
+		ticket = -1;
+		if (next != 0)
+		{
+			ticket = queue_read(offset + chunk, next, slots[slot ^ 1]);
+			nandqueue_kick();
+		}
+
+		decrypt_sectors(offset, chunk, buffer, slots[slot]);
+
+		if (next != 0 && ticket < 0)
+		{
+			return false;
+		}
+
+		offset += chunk;
+		len -= chunk;
+		buffer = ((u8*)buffer) + SECTOR_SIZE * chunk;
+		chunk = next;
+		slot ^= 1;
 	}
+
+	return true;
 }
 
+// reachable buffers skip the crypt buffers, every chunk is read straight into
+// place and decrypted there. the chunks are queued ahead so the ARM7 gets
+// them all in one command, while the ones that arrived are being decrypted
+static bool read_sectors_direct(sec_t offset, sec_t len, void *buffer)
+{
+	int tickets[SDMMC_QUEUE_LEN];
+	u32 head = 0;
+	u32 tail = 0;
+	sec_t queued = 0;
+	sec_t done = 0;
+	bool ok = true;
 
-static bool nandio_read_sectors(sec_t offset, sec_t len, void *buffer)
+	while (done < queued || (ok && queued < len))
+	{
+		bool added = false;
+		while (ok && queued < len && head - tail < SDMMC_QUEUE_LEN)
+		{
+			sec_t chunk = len - queued < xfer_sectors ? len - queued : xfer_sectors;
+			int ticket = queue_read(offset + queued, chunk, (u8*)buffer + queued * SECTOR_SIZE);
+			if (ticket < 0)
+				break;
+			tickets[head++ % SDMMC_QUEUE_LEN] = ticket;
+			queued += chunk;
+			added = true;
+		}
+		if (added)
+			nandqueue_kick();
+		if (head == tail)
+			return false;
+
+		sec_t chunk = queued - done < xfer_sectors ? queued - done : xfer_sectors;
+		if (!nandqueue_wait(tickets[tail++ % SDMMC_QUEUE_LEN]))
+			ok = false;
+		else if (ok)
+			decrypt_sectors(offset + done, chunk, (u8*)buffer + done * SECTOR_SIZE, (u8*)buffer + done * SECTOR_SIZE);
+		done += chunk;
+	}
+
+	return ok;
+}
+
+// the mirror image of the read pipeline, chunk N+1 gets encrypted while the
+// ARM7 writes chunk N
+static bool write_sectors_pipelined(sec_t offset, sec_t len, const void *buffer)
 {
-	while (len >= CRYPT_BUF_LEN)
+	u8 *slots[2] = { crypt_buf, crypt_buf_next };
+	int tickets[2] = { -1, -1 };
+	int slot = 0;
+	bool ok = true;
+
+	while (len > 0 && ok)
 	{
-		if (!read_sectors(offset, CRYPT_BUF_LEN, buffer))
+		sec_t chunk = len < xfer_sectors ? len : xfer_sectors;
+
+		// the slot is only free again once its previous write went out
+		if (tickets[slot] >= 0)
+		{
+			ok = nandqueue_wait(tickets[slot]);
+			tickets[slot] = -1;
+			if (!ok)
+				break;
+		}
+
+		if (arm7_crypt)
+			memcpy(slots[slot], buffer, chunk * SECTOR_SIZE);
+		else
+			dsi_nand_crypt(slots[slot], buffer, offset * SECTOR_SIZE / AES_BLOCK_SIZE, chunk * SECTOR_SIZE / AES_BLOCK_SIZE);
+		tickets[slot] = queue_write(offset, chunk, slots[slot]);
+		if (tickets[slot] < 0)
+		{
+			ok = false;
+			break;
+		}
+		nandqueue_kick();
+
+		offset += chunk;
+		len -= chunk;
+		buffer = ((const u8*)buffer) + SECTOR_SIZE * chunk;
+		slot ^= 1;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (tickets[i] >= 0 && !nandqueue_wait(tickets[i]))
+			ok = false;
+	}
+
+	return ok;
+}
+
+// len is guaranteed <= xfer_sectors
+static bool write_sectors(sec_t start, sec_t len, const void *buffer)
+{
+	if (arm7_crypt)
+	{
+		// the ARM7 encrypts in place, which must not hit the caller's buffer
+		memcpy(crypt_buf, buffer, len * SECTOR_SIZE);
+		u32 timing = profileStart();
+		bool written = arm7_encrypt_write(start, len, crypt_buf);
+		profileStop(PROFILE_NAND_WRITE, timing, len * SECTOR_SIZE, len);
+		return written;
+	}
+
+	const void *src = buffer;
+	// the AES engine can only stream from aligned main RAM, stage anything
+	// else in crypt_buf and encrypt it there in place
+	if (nandio_hw_crypt() && (((u32)buffer >> 24) != 0x02 || ((u32)buffer & 31) != 0))
+	{
+		memcpy(crypt_buf, buffer, len * SECTOR_SIZE);
+		src = crypt_buf;
+	}
+
+	dsi_nand_crypt(crypt_buf, src, start * SECTOR_SIZE / AES_BLOCK_SIZE, len * SECTOR_SIZE / AES_BLOCK_SIZE);
+	u32 timing = profileStart();
+	bool written = nand_WriteSectors(start, len, crypt_buf);
+	profileStop(PROFILE_NAND_WRITE, timing, len * SECTOR_SIZE, len);
+	return written;
+}
+
+
+// the AES engine lives on the ARM7 too, driving it from here leaves nothing
+// to overlap, unless the ARM7 crypts the transfers itself
+static bool can_pipeline()
+{
+	return crypt_buf_next != 0 && nandqueue_ready() && (!nandio_hw_crypt() || arm7_crypt);
+}
+
+static bool device_read_sectors(sec_t offset, sec_t len, void *buffer)
+{
+	if (len > xfer_sectors && can_pipeline() && arm7_can_reach(buffer))
+	{
+		return read_sectors_direct(offset, len, buffer);
+	}
+	if (len > xfer_sectors && can_pipeline())
+	{
+		return read_sectors_pipelined(offset, len, buffer);
+	}
+
+	while (len >= xfer_sectors)
+	{
+		if (!read_sectors(offset, xfer_sectors, buffer))
 		{
 			return false;
 		}
-		offset += CRYPT_BUF_LEN;
-		len -= CRYPT_BUF_LEN;
-		buffer = ((u8*)buffer) + SECTOR_SIZE * CRYPT_BUF_LEN;
+		offset += xfer_sectors;
+		len -= xfer_sectors;
+		buffer = ((u8*)buffer) + SECTOR_SIZE * xfer_sectors;
 	}
 	if (len > 0)
 	{
@@ -198,22 +662,22 @@ static bool nandio_read_sectors(sec_t offset, sec_t len, void *buffer)
 	}
 }
 
-static bool nandio_write_sectors(sec_t offset, sec_t len, const void *buffer)
+static bool device_write_sectors(sec_t offset, sec_t len, const void *buffer)
 {
-	if (writingLocked)
-		return false;
-
-	nandWritten = true;
+	if (len > xfer_sectors && can_pipeline())
+	{
+		return write_sectors_pipelined(offset, len, buffer);
+	}
 
-	while (len >= CRYPT_BUF_LEN)
+	while (len >= xfer_sectors)
 	{
-		if (!write_sectors(offset, CRYPT_BUF_LEN, buffer))
+		if (!write_sectors(offset, xfer_sectors, buffer))
 		{
 			return false;
 		}
-		offset += CRYPT_BUF_LEN;
-		len -= CRYPT_BUF_LEN;
-		buffer = ((u8*)buffer) + SECTOR_SIZE * CRYPT_BUF_LEN;
+		offset += xfer_sectors;
+		len -= xfer_sectors;
+		buffer = ((u8*)buffer) + SECTOR_SIZE * xfer_sectors;
 	}
 	if (len > 0)
 	{
@@ -224,6 +688,65 @@ static bool nandio_write_sectors(sec_t offset, sec_t len, const void *buffer)
 	}
 }
 
+static void mark_fat_dirty(sec_t offset, sec_t len)
+{
+	if (fat_dirty == 0 || offset >= fat_start + fat_sectors || offset + len <= fat_start)
+		return;
+
+	u32 first = offset > fat_start ? offset - fat_start : 0;
+	u32 end = offset + len - fat_start;
+	if (end > fat_sectors)
+		end = fat_sectors;
+	for (u32 sector = first; sector < end; sector++)
+		fat_dirty[sector / 32] |= 1u << (sector % 32);
+}
+
+static bool is_fat_dirty(u32 sector)
+{
+	return fat_dirty == 0 || sector >= fat_sectors || (fat_dirty[sector / 32] & (1u << (sector % 32)));
+}
+
+// everything but the fat copies past the first goes to the nand first, the
+// stages may only be updated once what they are synced from is in place
+static bool flush_before_stages()
+{
+	if (info.fat.numFats < 2)
+		return nandcache_flush();
+	return nandcache_flush_outside(info.fat.fatStart + info.fat.sectorsPerFat,
+		(info.fat.numFats - 1) * info.fat.sectorsPerFat);
+}
+
+static bool nandio_read_sectors(sec_t offset, sec_t len, void *buffer)
+{
+	return nandcache_read(offset, len, buffer);
+}
+
+static bool nandio_read_sectors_readonly(sec_t offset, sec_t len, void *buffer)
+{
+	if (boot_sector == 0 || offset != fat_sig_fix_offset || len == 0)
+		return nandcache_read(offset, len, buffer);
+	memcpy(buffer, boot_sector, SECTOR_SIZE);
+	return len == 1 || nandcache_read(offset + 1, len - 1, (u8*)buffer + SECTOR_SIZE);
+}
+
+static bool nandio_write_sectors_readonly(sec_t offset, sec_t len, const void *buffer)
+{
+	return false;
+}
+
+static bool nandio_write_sectors(sec_t offset, sec_t len, const void *buffer)
+{
+	if (writingLocked)
+		return false;
+
+	nandWritten = true;
+	mark_fat_dirty(offset, len);
+	// libfat may have changed a directory, fatraw's own writes keep it in step
+	fatraw_dir_cache_invalidate();
+
+	return nandcache_write(offset, len, buffer);
+}
+
 static bool nandio_clear_status()
 {
 	return true;
@@ -231,12 +754,45 @@ static bool nandio_clear_status()
 
 bool nandio_shutdown()
 {
-	nandio_synchronize_fats();
-	free(crypt_buf);
-	crypt_buf = 0;
+	// already shut down (fatUnmount does it too), only report what was left over
+	if (crypt_buf == 0)
+		return !nandWritten;
+
+	bool synced = nandio_synchronize_fats();
+	// nothing may stay behind in the cache once we're gone, the stages last
+	bool flushed = flush_before_stages() && nandcache_flush();
+	release_buffers();
+	return synced && flushed;
+}
+
+// nothing was written, so there are neither fat copies to sync nor dirty
+// sectors to flush
+static bool nandio_shutdown_readonly()
+{
+	release_buffers();
+	read_only = false;
 	return true;
 }
 
+void nandio_set_cache_size(u32 sectors)
+{
+	cache_sectors = sectors;
+}
+
+void nandio_set_transfer_size(u32 sectors)
+{
+	if (sectors != 0 && sectors < CRYPT_BUF_LEN)
+		sectors = CRYPT_BUF_LEN;
+	if (sectors > NAND_XFER_MAX_SECTORS)
+		sectors = NAND_XFER_MAX_SECTORS;
+	xfer_request = sectors;
+}
+
+u32 nandio_get_transfer_size()
+{
+	return xfer_sectors;
+}
+
 bool nandio_lock_writing()
 {
 	writingLocked = true;
@@ -246,6 +802,8 @@ bool nandio_lock_writing()
 
 bool nandio_unlock_writing()
 {
+	if (read_only)
+		return false;
 	writingLocked = false;
 
 	return !writingLocked;
@@ -254,43 +812,218 @@ bool nandio_unlock_writing()
 bool nandio_force_fat_fix()
 {
 	if (!writingLocked)
+	{
 		nandWritten = true;
+		// the copies are assumed stale everywhere, not just where we wrote
+		if (fat_dirty)
+			memset(fat_dirty, 0xFF, (fat_sectors + 31) / 32 * sizeof(u32));
+	}
 
 	return true;
 }
 
-void nandio_synchronize_fats()
+void nandio_hold_fat_copies()
 {
-	if (!nandWritten) return;
+	fatCopiesHeld = true;
+}
+
+bool nandio_hw_crypt()
+{
+	return dsi_nand_crypt_get_backend() == CRYPT_BACKEND_HARDWARE;
+}
+
+bool nandio_synchronize_fats()
+{
+	if (!nandWritten) return true;
+	// the first copy may be half written, the others are the intact fat now
+	if (fatCopiesHeld) return false;
+	// the first copy and the data it describes have to be on the nand before
+	// any stage is touched
+	bool ok = flush_before_stages();
+	u32 timing = profileStart();
+	u32 copied = 0;
 	// at cleanup we synchronize the FAT statgings
 	// A FatFS might have multiple copies of the FAT.
 	// we will get them back synchonized as we just worked on the first copy
 	// this allows us to revert changes in the FAT if we did not properly finish
 	// and did not push the changes to the other copies
 	// to do this we read the first partition sector
-	nandio_read_sectors(fat_sig_fix_offset, 1, sector_buf);
-	u8 stagingLevels = sector_buf[0x10];
-	u8 reservedSectors = sector_buf[0x0E];
-	u16 sectorsPerFatCopy = sector_buf[0x16] | ((u16)sector_buf[0x17] << 8);
+	// that was read once at startup already
+	u8 stagingLevels = info.fat.numFats;
+	u32 sectorsPerFatCopy = info.fat.sectorsPerFat;
 /*
 	iprintf("[i] Staging for %i FAT copies\n",stagingLevels);
-	iprintf("[i] Stages starting at %i\n",reservedSectors);
+	iprintf("[i] Stages starting at %lu\n",info.fat.fatStart);
 	iprintf("[i] %i sectors per stage\n",sectorsPerFatCopy);
 */
-	if (stagingLevels > 1)
+	if (ok && stagingLevels > 1)
 	{
-		for (u32 sector = 0;sector < sectorsPerFatCopy; sector++)
+		// copy the FAT in runs as long as a crypt buffer, so that every stage
+		// gets one multi sector write per run instead of one per sector
+		ArenaMark mark = arenaMark();
+		u32 runLen = xfer_sectors;
+		u8 *runBuf = (u8*)arenaAlloc(SECTOR_SIZE * xfer_sectors);
+		if (runBuf == 0)
 		{
-			// read fat sector
-			nandio_read_sectors(fat_sig_fix_offset + reservedSectors + sector, 1, sector_buf);
-			// write to each copy, except the source copy
-			writingLocked = false;
-			for (int stage = 1;stage < stagingLevels;stage++)
+			runLen = 1;
+			runBuf = sector_buf;
+		}
+		u32 fatStart = info.fat.fatStart;
+		u32 len;
+		writingLocked = false;
+		for (u32 sector = 0;sector < sectorsPerFatCopy; sector += len)
+		{
+			// only the sectors written since the last sync need to be copied
+			len = 1;
+			if (!is_fat_dirty(sector))
+				continue;
+			while (len < runLen && sector + len < sectorsPerFatCopy && is_fat_dirty(sector + len))
+				len++;
+			// read fat sectors, and write them to each copy except the source copy
+			ok = nandio_read_sectors(fatStart + sector, len, runBuf);
+			for (int stage = 1;ok && stage < stagingLevels;stage++)
 			{
-				nandio_write_sectors(fat_sig_fix_offset + reservedSectors + sector + (stage *sectorsPerFatCopy), 1, sector_buf);
+				ok = nandio_write_sectors(fatStart + sector + (stage * sectorsPerFatCopy), len, runBuf);
 			}
-			writingLocked = true;
+			// the copies stay marked stale, a later sync can pick it up again
+			if (!ok)
+				break;
+			copied += len;
 		}
+		writingLocked = true;
+		arenaReset(mark);
 	}
+	profileStop(PROFILE_FAT_SYNC, timing, copied * SECTOR_SIZE, copied);
+	if (!ok)
+		return false;
+	if (fat_dirty)
+		memset(fat_dirty, 0, (fat_sectors + 31) / 32 * sizeof(u32));
 	nandWritten = false;
+	return true;
+}
+
+bool nandio_stream_sectors(sec_t start, sec_t len, nandio_sink_fn sink, void *user)
+{
+	// the device has to be current, the cache may hold newer sectors than it
+	if (!nandcache_flush())
+		return false;
+
+	if (len <= xfer_sectors || !can_pipeline())
+	{
+		while (len > 0)
+		{
+			sec_t chunk = len < xfer_sectors ? len : xfer_sectors;
+			if (!read_sectors(start, chunk, crypt_buf) || !sink(crypt_buf, chunk, user))
+				return false;
+			start += chunk;
+			len -= chunk;
+		}
+		return true;
+	}
+
+	// same as read_sectors_pipelined, but the chunks are decrypted in place
+	// and handed to sink while the next one is being read
+	u8 *slots[2] = { crypt_buf, crypt_buf_next };
+	int slot = 0;
+	sec_t chunk = xfer_sectors;
+	bool ok = true;
+
+	int ticket = queue_read(start, chunk, slots[slot]);
+	if (ticket < 0)
+	{
+		return false;
+	}
+	nandqueue_kick();
+
+	while (len > 0)
+	{
+		if (!nandqueue_wait(ticket))
+		{
+			return false;
+		}
+
+		sec_t next = len - chunk;
+		if (next > xfer_sectors)
+			next = xfer_sectors;
+		ticket = -1;
+		if (next != 0)
+		{
+			ticket = queue_read(start + chunk, next, slots[slot ^ 1]);
+			nandqueue_kick();
+		}
+
+		decrypt_sectors(start, chunk, slots[slot], slots[slot]);
+		ok = sink(slots[slot], chunk, user);
+
+		if (next != 0 && ticket < 0)
+		{
+			return false;
+		}
+		if (!ok)
+		{
+			// the chunk in flight still has to be collected
+			if (ticket >= 0)
+				nandqueue_wait(ticket);
+			return false;
+		}
+
+		start += chunk;
+		len -= chunk;
+		chunk = next;
+		slot ^= 1;
+	}
+
+	return true;
+}
+
+const nandio_info_t *nandio_get_info()
+{
+	return &info;
+}
+
+static bool first_sector(sec_t start, sec_t len, uint32_t bytes, void *user)
+{
+	sec_t *first = (sec_t*)user;
+	if (*first == 0)
+		*first = start;
+	return true;
+}
+
+// keeps the lowest n of the 0000000n.app files
+static bool lowest_app(const char shortName[11], uint8_t attr, uint32_t size, void *user)
+{
+	uint32_t *version = (uint32_t*)user;
+	if ((attr & FATRAW_ATTR_DIRECTORY) == 0 && memcmp(shortName, "0000000", 7) == 0
+		&& shortName[7] >= '0' && shortName[7] <= '9' && memcmp(shortName + 8, "APP", 3) == 0
+		&& (uint32_t)(shortName[7] - '0') < *version)
+		*version = shortName[7] - '0';
+	return true;
+}
+
+bool nandio_resolve_launcher()
+{
+	if (info.launcherResolved)
+		return true;
+	if (!info.valid || !fatraw_init_geometry(&io_dsi_nand, &info.fat))
+		return false;
+
+	// the tid is at 0xA0, inside the first sector
+	sec_t hwinfo = 0;
+	uint32_t size = 0;
+	if (!fatraw_file_runs("nand:/sys/HWINFO_S.dat", first_sector, &hwinfo, &size)
+		|| size < 0xA4 || hwinfo == 0
+		|| !nandio_read_sectors(hwinfo, 1, sector_buf))
+		return false;
+	memcpy(&info.launcherTid, sector_buf + 0xA0, sizeof(info.launcherTid));
+
+	// one listing of the content directory, it stays cached for the tmd and
+	// app lookups that follow
+	char path[64];
+	sprintf(path, "nand:/title/00030017/%08lx/content", (unsigned long)info.launcherTid);
+	uint32_t version = 10;
+	if (!fatraw_list_dir(path, lowest_app, &version) || version == 10)
+		return false;
+	info.launcherAppVersion = version;
+	info.launcherResolved = true;
+	return true;
 }
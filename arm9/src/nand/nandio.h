@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <nds/disc_io.h>
+#include "fatraw.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,22 +10,79 @@ extern "C" {
 
 /************************ Constants / Defines *********************************/
 
+// sectors per transfer, CRYPT_BUF_LEN is the smallest the crypt buffers get.
+// plain transfers still run inside the libnds fifo irq on the arm7, at the
+// ~8 MiB/s the bus peaks at 128 sectors take about 8ms, under one frame
 #define CRYPT_BUF_LEN         64
+#define NAND_XFER_MAX_SECTORS 128
 #define NAND_DEVICENAME       (('N' << 24) | ('A' << 16) | ('N' << 8) | 'D')
 
 extern const DISC_INTERFACE   io_dsi_nand;
+// for checks that never write, only reads are advertised, writes aren't
+// tracked and the fat copies aren't synced on shutdown
+extern const DISC_INTERFACE   io_dsi_nand_readonly;
+
+// what the first nandio_startup works out about the nand, later mounts and
+// everything that needs the layout read it from here instead of probing again
+typedef struct {
+	bool valid;
+	bool is3DS;
+	uint8_t cid[16];
+	uint8_t consoleId[8];      // big endian, as dsi_crypt_init takes it
+	uint32_t partitionStart;   // first (twln) partition, in sectors
+	uint32_t partitionSectors;
+	fatraw_geometry fat;       // of that partition, fatBits is 0 if its bpb is unusable
+
+	// filled by nandio_resolve_launcher
+	bool launcherResolved;
+	uint32_t launcherTid;      // 0 if HWINFO_S.dat couldn't be read
+	uint32_t launcherAppVersion; // the n of content/0000000n.app
+} nandio_info_t;
 
 /************************ Function Protoypes **********************************/
 
 void nandio_set_fat_sig_fix(uint32_t offset);
 
+// sectors of decrypted data to cache, takes effect on the next mount
+void nandio_set_cache_size(uint32_t sectors);
+
+// sectors per transfer, 0 sizes them from free memory (the default), takes
+// effect on the next mount
+void nandio_set_transfer_size(uint32_t sectors);
+uint32_t nandio_get_transfer_size();
+
 
 extern bool nandio_shutdown();
 
 extern bool nandio_lock_writing();
+// fails while mounted through io_dsi_nand_readonly
 extern bool nandio_unlock_writing();
 extern bool nandio_force_fat_fix();
-extern void nandio_synchronize_fats();
+// copies the sectors of the first fat written since the last sync to the
+// other copies, on failure they stay marked for the next try
+extern bool nandio_synchronize_fats();
+// after a write to the first fat failed partway, keeps the other copies as they
+// are for the rest of the mount instead of syncing the broken one over them.
+// nandio_synchronize_fats and nandio_shutdown report failure from then on
+extern void nandio_hold_fat_copies();
+
+const nandio_info_t *nandio_get_info();
+
+// looks up the launcher tid in sys/HWINFO_S.dat and which 0000000n.app it has
+// straight through fatraw, once, needs the nand mounted
+extern bool nandio_resolve_launcher();
+
+// whether sectors go through the AES engine instead of polarssl
+extern bool nandio_hw_crypt();
+
+// gets up to nandio_get_transfer_size() decrypted sectors at a time, straight from the
+// crypt buffer, the data is only valid during the call and sink must not
+// read or write the nand itself
+typedef bool (*nandio_sink_fn)(const void *data, sec_t len, void *user);
+
+// reads a run of sectors past the cache (it's flushed first) and hands them
+// to sink in order, the next chunk is fetched while sink works on the last one
+extern bool nandio_stream_sectors(sec_t start, sec_t len, nandio_sink_fn sink, void *user);
 
 #ifdef __cplusplus
 }
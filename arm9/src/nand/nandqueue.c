@@ -0,0 +1,101 @@
+#include <nds.h>
+#include <string.h>
+#include "nandqueue.h"
+#include "sdmmc_queue.h"
+#include "../arena.h"
+
+#define QUEUE_ALLOC_SIZE ((sizeof(SdmmcQueue) + 31) & ~31)
+
+// the ARM7 gets the cached address, we only ever touch the uncached mirror so
+// nothing of the ring can linger in the data cache
+static SdmmcQueue *queue_mem = 0;
+static SdmmcQueue *queue = 0;
+static u32 queue_head = 0;
+
+bool nandqueue_init()
+{
+	if (queue_mem == 0)
+	{
+		queue_mem = (SdmmcQueue*)arenaAllocPersistent(QUEUE_ALLOC_SIZE);
+		if (queue_mem == 0)
+			return false;
+		DC_InvalidateRange(queue_mem, QUEUE_ALLOC_SIZE);
+		queue = (SdmmcQueue*)memUncached(queue_mem);
+	}
+
+	for (int i = 0; i < SDMMC_QUEUE_LEN; i++)
+	{
+		queue->entries[i].status = SDMMC_QUEUE_FREE;
+	}
+	queue->next = 0;
+	queue_head = 0;
+	return true;
+}
+
+// like the cache, the ring goes back with the mount's arena reset
+void nandqueue_deinit()
+{
+	queue_mem = 0;
+	queue = 0;
+}
+
+bool nandqueue_ready()
+{
+	return queue != 0;
+}
+
+static int nandqueue_submit(u32 op, sec_t start, sec_t len, void *buffer)
+{
+	SdmmcQueueEntry *entry = &queue->entries[queue_head % SDMMC_QUEUE_LEN];
+	if (entry->status != SDMMC_QUEUE_FREE)
+		return -1;
+
+	DC_FlushRange(buffer, len * 512);
+
+	entry->op = op;
+	entry->start = start;
+	entry->count = len;
+	entry->buffer = buffer;
+	entry->status = SDMMC_QUEUE_PENDING;
+
+	return queue_head++ % SDMMC_QUEUE_LEN;
+}
+
+int nandqueue_read(sec_t start, sec_t len, void *buffer)
+{
+	return nandqueue_submit(SDMMC_QUEUE_NAND_READ, start, len, buffer);
+}
+
+int nandqueue_write(sec_t start, sec_t len, const void *buffer)
+{
+	return nandqueue_submit(SDMMC_QUEUE_NAND_WRITE, start, len, (void*)buffer);
+}
+
+int nandqueue_decrypt_read(sec_t start, sec_t len, void *buffer)
+{
+	return nandqueue_submit(SDMMC_QUEUE_NAND_DECRYPT_READ, start, len, buffer);
+}
+
+int nandqueue_encrypt_write(sec_t start, sec_t len, void *buffer)
+{
+	return nandqueue_submit(SDMMC_QUEUE_NAND_ENCRYPT_WRITE, start, len, buffer);
+}
+
+void nandqueue_kick()
+{
+	fifoSendAddress(FIFO_SDMMC_QUEUE, queue_mem);
+}
+
+bool nandqueue_wait(int ticket)
+{
+	SdmmcQueueEntry *entry = &queue->entries[ticket];
+
+	while (entry->status == SDMMC_QUEUE_PENDING);
+
+	bool ok = entry->status == SDMMC_QUEUE_DONE;
+	// everything but a plain write leaves new data in the buffer
+	if (entry->op != SDMMC_QUEUE_NAND_WRITE)
+		DC_InvalidateRange(entry->buffer, entry->count * 512);
+	entry->status = SDMMC_QUEUE_FREE;
+	return ok;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <nds/disc_io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/************************ Function Protoypes **********************************/
+
+// raw (still encrypted) sector transfers handed to the ARM7 through a shared
+// ring, several of them can be outstanding at once
+bool nandqueue_init();
+void nandqueue_deinit();
+bool nandqueue_ready();
+
+// returns a ticket for nandqueue_wait, or -1 if the ring is full
+int nandqueue_read(sec_t start, sec_t len, void *buffer);
+int nandqueue_write(sec_t start, sec_t len, const void *buffer);
+
+// same, but the ARM7 runs the nand crypt on the sectors itself, only valid
+// once the hardware crypt backend is on. the write buffer is encrypted in place
+int nandqueue_decrypt_read(sec_t start, sec_t len, void *buffer);
+int nandqueue_encrypt_write(sec_t start, sec_t len, void *buffer);
+
+// tell the ARM7 there's new work, requests are only picked up after this
+void nandqueue_kick();
+
+// blocks until the request is finished, every ticket has to be waited on once
+bool nandqueue_wait(int ticket);
+
+#ifdef __cplusplus
+}
+#endif
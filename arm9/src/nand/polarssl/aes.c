@@ -38,6 +38,20 @@
 
 #include <string.h>
 
+/*
+ * TCM placement, the ITCM code is built as ARM since it is fetched
+ * without wait states
+ */
+#if defined(POLARSSL_AES_TCM)
+#define AES_ITCM_CODE __attribute__((section(".itcm"), long_call, target("arm")))
+#define AES_DTCM_DATA __attribute__((section(".dtcm")))
+#define AES_DTCM_BSS  __attribute__((section(".sbss")))
+#else
+#define AES_ITCM_CODE
+#define AES_DTCM_DATA
+#define AES_DTCM_BSS
+#endif
+
 /*
  * 32-bit integer manipulation macros (little endian)
  */
@@ -65,7 +79,7 @@
 /*
  * Forward S-box
  */
-static const unsigned char FSb[256] =
+static const unsigned char FSb[256] AES_DTCM_DATA =
 {
     0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5,
     0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
@@ -172,23 +186,24 @@ static const unsigned char FSb[256] =
     V(CB,B0,B0,7B), V(FC,54,54,A8), V(D6,BB,BB,6D), V(3A,16,16,2C)
 
 #define V(a,b,c,d) 0x##a##b##c##d
-static const unsigned long FT0[256] = { FT };
+static const unsigned long FT0[256] AES_DTCM_DATA = { FT };
 #undef V
 
 #define V(a,b,c,d) 0x##b##c##d##a
-static const unsigned long FT1[256] = { FT };
+static const unsigned long FT1[256] AES_DTCM_DATA = { FT };
 #undef V
 
 #define V(a,b,c,d) 0x##c##d##a##b
-static const unsigned long FT2[256] = { FT };
+static const unsigned long FT2[256] AES_DTCM_DATA = { FT };
 #undef V
 
 #define V(a,b,c,d) 0x##d##a##b##c
-static const unsigned long FT3[256] = { FT };
+static const unsigned long FT3[256] AES_DTCM_DATA = { FT };
 #undef V
 
 #undef FT
 
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
 /*
  * Reverse S-box
  */
@@ -315,11 +330,12 @@ static const unsigned long RT3[256] = { RT };
 #undef V
 
 #undef RT
+#endif /* !POLARSSL_AES_ENCRYPT_ONLY */
 
 /*
  * Round constants
  */
-static const unsigned long RCON[10] =
+static const unsigned long RCON[10] AES_DTCM_DATA =
 {
     0x00000001, 0x00000002, 0x00000004, 0x00000008,
     0x00000010, 0x00000020, 0x00000040, 0x00000080,
@@ -331,12 +347,13 @@ static const unsigned long RCON[10] =
 /*
  * Forward S-box & tables
  */
-static unsigned char FSb[256];
-static unsigned long FT0[256];
-static unsigned long FT1[256];
-static unsigned long FT2[256];
-static unsigned long FT3[256];
+static unsigned char FSb[256] AES_DTCM_BSS;
+static unsigned long FT0[256] AES_DTCM_BSS;
+static unsigned long FT1[256] AES_DTCM_BSS;
+static unsigned long FT2[256] AES_DTCM_BSS;
+static unsigned long FT3[256] AES_DTCM_BSS;
 
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
 /*
  * Reverse S-box & tables
  */
@@ -345,11 +362,12 @@ static unsigned long RT0[256];
 static unsigned long RT1[256];
 static unsigned long RT2[256];
 static unsigned long RT3[256];
+#endif
 
 /*
  * Round constants
  */
-static unsigned long RCON[10];
+static unsigned long RCON[10] AES_DTCM_BSS;
 
 /*
  * Tables generation code
@@ -389,7 +407,9 @@ static void aes_gen_tables( void )
      * generate the forward and reverse S-boxes
      */
     FSb[0x00] = 0x63;
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
     RSb[0x63] = 0x00;
+#endif
 
     for( i = 1; i < 256; i++ )
     {
@@ -402,7 +422,9 @@ static void aes_gen_tables( void )
         x ^= y ^ 0x63;
 
         FSb[i] = (unsigned char) x;
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
         RSb[x] = (unsigned char) i;
+#endif
     }
 
     /*
@@ -423,6 +445,7 @@ static void aes_gen_tables( void )
         FT2[i] = ROTL8( FT1[i] );
         FT3[i] = ROTL8( FT2[i] );
 
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
         x = RSb[i];
 
         RT0[i] = ( (unsigned long) MUL( 0x0E, x )       ) ^
@@ -433,6 +456,7 @@ static void aes_gen_tables( void )
         RT1[i] = ROTL8( RT0[i] );
         RT2[i] = ROTL8( RT1[i] );
         RT3[i] = ROTL8( RT2[i] );
+#endif
     }
 }
 
@@ -548,6 +572,12 @@ int aes_setkey_enc( aes_context *ctx, const unsigned char *key, int keysize )
  */
 int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
 {
+#if defined(POLARSSL_AES_ENCRYPT_ONLY)
+    (void) ctx;
+    (void) key;
+    (void) keysize;
+    return( POLARSSL_ERR_AES_FEATURE_UNAVAILABLE );
+#else
     int i, j;
     aes_context cty;
     unsigned long *RK;
@@ -598,6 +628,7 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
     memset( &cty, 0, sizeof( aes_context ) );
 
     return( 0 );
+#endif /* POLARSSL_AES_ENCRYPT_ONLY */
 }
 
 #define AES_FROUND(X0,X1,X2,X3,Y0,Y1,Y2,Y3)     \
@@ -623,6 +654,7 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
                  FT3[ ( Y2 >> 24 ) & 0xFF ];    \
 }
 
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
 #define AES_RROUND(X0,X1,X2,X3,Y0,Y1,Y2,Y3)     \
 {                                               \
     X0 = *RK++ ^ RT0[ ( Y0       ) & 0xFF ] ^   \
@@ -645,11 +677,12 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
                  RT2[ ( Y1 >> 16 ) & 0xFF ] ^   \
                  RT3[ ( Y0 >> 24 ) & 0xFF ];    \
 }
+#endif
 
 /*
  * AES-ECB block encryption/decryption
  */
-int aes_crypt_ecb( aes_context *ctx,
+int AES_ITCM_CODE aes_crypt_ecb( aes_context *ctx,
                     int mode,
                     const unsigned char input[16],
                     unsigned char output[16] )
@@ -669,6 +702,11 @@ int aes_crypt_ecb( aes_context *ctx,
     }
 #endif
 
+#if defined(POLARSSL_AES_ENCRYPT_ONLY)
+    if( mode == AES_DECRYPT )
+        return( POLARSSL_ERR_AES_FEATURE_UNAVAILABLE );
+#endif
+
     RK = ctx->rk;
 
     GET_ULONG_LE( X0, input,  0 ); X0 ^= *RK++;
@@ -676,6 +714,7 @@ int aes_crypt_ecb( aes_context *ctx,
     GET_ULONG_LE( X2, input,  8 ); X2 ^= *RK++;
     GET_ULONG_LE( X3, input, 12 ); X3 ^= *RK++;
 
+#if !defined(POLARSSL_AES_ENCRYPT_ONLY)
     if( mode == AES_DECRYPT )
     {
         for( i = (ctx->nr >> 1) - 1; i > 0; i-- )
@@ -711,6 +750,7 @@ int aes_crypt_ecb( aes_context *ctx,
                 ( (unsigned long) RSb[ ( Y0 >> 24 ) & 0xFF ] << 24 );
     }
     else /* AES_ENCRYPT */
+#endif
     {
         for( i = (ctx->nr >> 1) - 1; i > 0; i-- )
         {
@@ -781,6 +821,11 @@ int aes_crypt_cbc( aes_context *ctx,
     }
 #endif
 
+#if defined(POLARSSL_AES_ENCRYPT_ONLY)
+    if( mode == AES_DECRYPT )
+        return( POLARSSL_ERR_AES_FEATURE_UNAVAILABLE );
+#endif
+
     if( mode == AES_DECRYPT )
     {
         while( length > 0 )
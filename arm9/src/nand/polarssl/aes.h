@@ -30,6 +30,7 @@
 
 #define POLARSSL_ERR_AES_INVALID_KEY_LENGTH                 -0x0800
 #define POLARSSL_ERR_AES_INVALID_INPUT_LENGTH               -0x0810
+#define POLARSSL_ERR_AES_FEATURE_UNAVAILABLE                -0x0820
 
 /**
  * \brief          AES context structure
@@ -64,7 +65,9 @@ int aes_setkey_enc( aes_context *ctx, const unsigned char *key, int keysize );
  * \param key      decryption key
  * \param keysize  must be 128, 192 or 256
  *
- * \return         0 if successful, or POLARSSL_ERR_AES_INVALID_KEY_LENGTH
+ * \return         0 if successful, POLARSSL_ERR_AES_INVALID_KEY_LENGTH
+ *                 or POLARSSL_ERR_AES_FEATURE_UNAVAILABLE with
+ *                 POLARSSL_AES_ENCRYPT_ONLY
  */
 int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize );
 
@@ -76,7 +79,8 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize );
  * \param input    16-byte input block
  * \param output   16-byte output block
  *
- * \return         0 if successful
+ * \return         0 if successful, or POLARSSL_ERR_AES_FEATURE_UNAVAILABLE
+ *                 when decrypting with POLARSSL_AES_ENCRYPT_ONLY
  */
 int aes_crypt_ecb( aes_context *ctx,
                     int mode,
@@ -48,6 +48,16 @@
 
 #include <string.h>
 
+/*
+ * The multiply-accumulate inner loop is run from ITCM, this file is built as
+ * ARM so bn_mul.h picks the umull based MULADDC rather than the THUMB one
+ */
+#if defined(POLARSSL_BIGNUM_TCM)
+#define BIGNUM_ITCM_CODE __attribute__((section(".itcm"), long_call, target("arm")))
+#else
+#define BIGNUM_ITCM_CODE
+#endif
+
 #if defined(MBEDTLS_PLATFORM_C)
 #include "mbedtls/platform.h"
 #else
@@ -1108,6 +1118,7 @@ static
  */
 __attribute__ ((noinline))
 #endif
+BIGNUM_ITCM_CODE
 void mpi_mul_hlp( size_t i, mbedtls_mpi_uint *s, mbedtls_mpi_uint *d, mbedtls_mpi_uint b )
 {
     mbedtls_mpi_uint c = 0, t = 0;
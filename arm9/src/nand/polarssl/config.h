@@ -3,3 +3,15 @@
 #define POLARSSL_AES_C
 
 #define MBEDTLS_HAVE_ASM
+
+/* keep the round function in ITCM and the lookup tables in DTCM */
+#if defined(ARM9)
+#define POLARSSL_AES_TCM
+#define POLARSSL_BIGNUM_TCM
+#endif
+
+/* only the encryption direction is needed for ctr/ccm on the ARM9, the
+ * decryption tables are dropped unless it is built with POLARSSL_AES_DECRYPT */
+#if defined(ARM9) && !defined(POLARSSL_AES_DECRYPT)
+#define POLARSSL_AES_ENCRYPT_ONLY
+#endif
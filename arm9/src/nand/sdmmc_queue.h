@@ -0,0 +1,63 @@
+#ifndef SDMMC_QUEUE_H
+#define SDMMC_QUEUE_H
+#include <nds/ndstypes.h>
+#include <nds/fifocommon.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// kept in sync between arm7/src/sdmmc_queue.h and arm9/src/nand/sdmmc_queue.h
+// the arm9 sends the queue address on this channel whenever it added requests
+#define FIFO_SDMMC_QUEUE FIFO_USER_05
+
+#define SDMMC_QUEUE_LEN 8
+
+typedef enum {
+	SDMMC_QUEUE_NAND_READ,
+	SDMMC_QUEUE_NAND_WRITE,
+	// the arm7 runs the nand ctr crypt itself with the counter sent through
+	// AES_FIFO_NAND_SET_CTR. writes are encrypted in place, the buffer holds
+	// the ciphertext afterwards
+	SDMMC_QUEUE_NAND_DECRYPT_READ,
+	SDMMC_QUEUE_NAND_ENCRYPT_WRITE,
+} SdmmcQueueOp;
+
+typedef enum {
+	SDMMC_QUEUE_FREE,
+	SDMMC_QUEUE_PENDING,
+	SDMMC_QUEUE_DONE,
+	SDMMC_QUEUE_FAILED,
+} SdmmcQueueStatus;
+
+typedef struct SdmmcQueueEntry {
+	u32 op;
+	u32 start;
+	u32 count;
+	void* buffer;
+	vu32 status; // written last by both sides
+} SdmmcQueueEntry;
+
+// builds with NAND_PROFILE only, the arm9 sends where the arm7 should
+// count its sdmmc commands on this channel once at startup
+#define FIFO_SDMMC_PROFILE FIFO_USER_06
+
+typedef struct SdmmcProfile {
+	u32 calls;
+	u32 sectors;
+	u64 bytes;
+	u64 ticks; // at BUS_CLOCK
+} SdmmcProfile;
+
+// a ring of requests, the arm9 fills entries in order and the arm7 works
+// through them in the same order, flagging each one once it's done
+typedef struct SdmmcQueue {
+	SdmmcQueueEntry entries[SDMMC_QUEUE_LEN];
+	vu32 next; // next entry the arm7 will look at
+} SdmmcQueue;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+#include <nds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tmdsig.h"
+#include "crypto.h"
+#include "ticket0.h"
+#include "polarssl/bignum.h"
+
+/************************ Constants / Defines *********************************/
+
+#define SIG_TYPE_RSA4096      0x00010000
+#define SIG_TYPE_ECC          0x00010002
+
+#define KEY_TYPE_RSA4096      0
+#define KEY_TYPE_RSA2048      1
+#define KEY_TYPE_ECC          2
+
+#define CERT_NAME_LEN         0x40
+#define CERT_MAX_SIZE         0x2000
+
+typedef struct {
+	char name[CERT_NAME_LEN * 2];
+	mbedtls_mpi N;
+	mbedtls_mpi E;
+	// R^2 mod N, filled by the first exp_mod with this key
+	mbedtls_mpi RR;
+} tmdsig_key;
+
+static tmdsig_key keys[TMDSIG_MAX_KEYS];
+static u32 key_count = 0;
+
+// pkcs#1 v1.5 DigestInfo for sha1, the hash follows it
+static const u8 sha1_digest_info[] = {
+	0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14
+};
+
+static u32 get32be(const u8 *p)
+{
+	return ((u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static u16 get16be(const u8 *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+// size of the signature block, including the padding up to the issuer
+static u32 sig_block_len(u32 type)
+{
+	switch (type)
+	{
+		case SIG_TYPE_RSA4096: return 4 + 0x200 + 0x3c;
+		case TMDSIG_TYPE_RSA2048: return 4 + 0x100 + 0x3c;
+		case SIG_TYPE_ECC: return 4 + 0x3c + 0x40;
+	}
+	return 0;
+}
+
+// size of the public key, including its padding
+static u32 key_block_len(u32 type)
+{
+	switch (type)
+	{
+		case KEY_TYPE_RSA4096: return 0x200 + 4 + 0x34;
+		case KEY_TYPE_RSA2048: return 0x100 + 4 + 0x34;
+		case KEY_TYPE_ECC: return 0x3c + 0x3c;
+	}
+	return 0;
+}
+
+static void add_key(const char *issuer, const char *name, const u8 *modulus, const u8 *exponent)
+{
+	if (key_count == TMDSIG_MAX_KEYS)
+		return;
+
+	tmdsig_key *key = &keys[key_count];
+	snprintf(key->name, sizeof(key->name), "%.*s-%.*s", CERT_NAME_LEN, issuer, CERT_NAME_LEN, name);
+	mbedtls_mpi_init(&key->N);
+	mbedtls_mpi_init(&key->E);
+	mbedtls_mpi_init(&key->RR);
+	if (mbedtls_mpi_read_binary(&key->N, modulus, RSA_2048_LEN) != 0
+		|| mbedtls_mpi_read_binary(&key->E, exponent, 4) != 0)
+	{
+		mbedtls_mpi_free(&key->N);
+		mbedtls_mpi_free(&key->E);
+		return;
+	}
+	key_count++;
+}
+
+bool tmdsig_init(const char *certPath)
+{
+	tmdsig_deinit();
+
+	FILE *file = fopen(certPath, "rb");
+	if (!file)
+		return false;
+
+	u8 *certs = (u8*)malloc(CERT_MAX_SIZE);
+	if (!certs)
+	{
+		fclose(file);
+		return false;
+	}
+	size_t size = fread(certs, 1, CERT_MAX_SIZE, file);
+	fclose(file);
+
+	// certificates are packed back to back, their size depends on both the
+	// signature and the key type
+	size_t offset = 0;
+	while (offset + 4 <= size)
+	{
+		u32 sigLen = sig_block_len(get32be(certs + offset));
+		if (sigLen == 0 || offset + sigLen + CERT_NAME_LEN + 4 + CERT_NAME_LEN + 4 > size)
+			break;
+
+		const u8 *body = certs + offset + sigLen;
+		u32 keyType = get32be(body + CERT_NAME_LEN);
+		u32 keyLen = key_block_len(keyType);
+		u32 certLen = sigLen + CERT_NAME_LEN + 4 + CERT_NAME_LEN + 4 + keyLen;
+		if (keyLen == 0 || offset + certLen > size)
+			break;
+
+		// same layout as cert_t from the issuer on
+		if (keyType == KEY_TYPE_RSA2048)
+		{
+			const cert_t *cert = (const cert_t*)(body - offsetof(cert_t, signature_name));
+			add_key(cert->signature_name, cert->key_name, cert->rsa_key, cert->rsa_exp);
+		}
+		offset += certLen;
+	}
+
+	free(certs);
+	return key_count != 0;
+}
+
+void tmdsig_deinit()
+{
+	for (u32 i = 0; i < key_count; i++)
+	{
+		mbedtls_mpi_free(&keys[i].N);
+		mbedtls_mpi_free(&keys[i].E);
+		mbedtls_mpi_free(&keys[i].RR);
+	}
+	key_count = 0;
+}
+
+static tmdsig_key *find_key(const char *issuer)
+{
+	for (u32 i = 0; i < key_count; i++)
+	{
+		if (strncmp(keys[i].name, issuer, CERT_NAME_LEN) == 0)
+			return &keys[i];
+	}
+	return NULL;
+}
+
+// sig^e mod n, with e being 65537 on every retail key exp_mod settles on a
+// window of 1, that's 16 montgomery squarings and one multiply once R^2 mod N
+// has been worked out the first time the key is used
+static bool rsa_public(tmdsig_key *key, const u8 *sig, u8 *out)
+{
+	mbedtls_mpi S, M;
+	mbedtls_mpi_init(&S);
+	mbedtls_mpi_init(&M);
+
+	bool ret = mbedtls_mpi_read_binary(&S, sig, RSA_2048_LEN) == 0
+		&& mbedtls_mpi_cmp_mpi(&S, &key->N) < 0
+		&& mbedtls_mpi_exp_mod(&M, &S, &key->E, &key->N, &key->RR) == 0
+		&& mbedtls_mpi_write_binary(&M, out, RSA_2048_LEN) == 0;
+
+	mbedtls_mpi_free(&S);
+	mbedtls_mpi_free(&M);
+	return ret;
+}
+
+bool tmdsig_verify(const uint8_t *tmd, size_t len)
+{
+	const tmd_header_v0_t *header = (const tmd_header_v0_t*)tmd;
+	if (len < sizeof(tmd_header_v0_t) || get32be(header->sig_type) != TMDSIG_TYPE_RSA2048)
+		return false;
+
+	if (len != sizeof(tmd_header_v0_t) + get16be(header->num_content) * sizeof(tmd_content_v0_t))
+		return false;
+
+	tmdsig_key *key = find_key(header->issuer);
+	if (!key)
+		return false;
+
+	u8 decoded[RSA_2048_LEN];
+	if (!rsa_public(key, header->sig, decoded))
+		return false;
+
+	// 00 01 ff .. ff 00 DigestInfo sha1
+	const size_t hashOffset = RSA_2048_LEN - SHA1_LEN;
+	const size_t infoOffset = hashOffset - sizeof(sha1_digest_info);
+	if (decoded[0] != 0x00 || decoded[1] != 0x01 || decoded[infoOffset - 1] != 0x00)
+		return false;
+	for (size_t i = 2; i < infoOffset - 1; i++)
+	{
+		if (decoded[i] != 0xff)
+			return false;
+	}
+	if (memcmp(decoded + infoOffset, sha1_digest_info, sizeof(sha1_digest_info)) != 0)
+		return false;
+
+	u8 hash[SHA1_LEN];
+	swiSHA1Calc(hash, header->issuer, len - offsetof(tmd_header_v0_t, issuer));
+	return memcmp(decoded + hashOffset, hash, SHA1_LEN) == 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/************************ Constants / Defines *********************************/
+
+// rsa-2048 keys kept from cert.sys, a retail one has CA, XS and CP
+#define TMDSIG_MAX_KEYS       4
+
+#define TMDSIG_TYPE_RSA2048   0x00010001
+
+/************************ Function Protoypes **********************************/
+
+// loads the rsa-2048 public keys of the certificate chain at path
+bool tmdsig_init(const char *certPath);
+void tmdsig_deinit();
+
+// checks a v0 tmd's signature against its issuer's key, len must be exactly
+// the header and its content records so padded files don't pass
+bool tmdsig_verify(const uint8_t *tmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
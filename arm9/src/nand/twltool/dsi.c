@@ -93,15 +93,79 @@ void dsi_crypt_ctr_block(dsi_context* ctx, const unsigned char input[16], unsign
 	dsi_add_ctr(ctx, 1);
 }
 
+void dsi_ctr_load(dsi_ctr* ctr, const unsigned char ctr_le[16])
+{
+	int i;
 
-void dsi_init_ccm(dsi_context* ctx, unsigned char key[16], unsigned int maclength,
-				  unsigned int payloadlength, unsigned int assoclength, unsigned char nonce[12])
+	for (i = 0; i < 4; i++)
+		ctr->w[i] = ctr_le[i * 4 + 0] | (ctr_le[i * 4 + 1] << 8) |
+			(ctr_le[i * 4 + 2] << 16) | ((unsigned int)ctr_le[i * 4 + 3] << 24);
+}
+
+void dsi_ctr_add(dsi_ctr* ctr, unsigned int carry)
 {
+	unsigned int old = ctr->w[0];
+
+	ctr->w[0] += carry;
+	if (ctr->w[0] < old && ++ctr->w[1] == 0 && ++ctr->w[2] == 0)
+		++ctr->w[3];
+}
+
+// ctr mode over whole blocks without touching ctx->ctr, in and out may be the same buffer
+void dsi_crypt_ctr_blocks(dsi_context* ctx, dsi_ctr* ctr, const void* in, void* out, unsigned int blocks)
+{
+	unsigned int block[4];
+	unsigned int stream[4];
+	const unsigned char* in8 = in;
+	unsigned char* out8 = out;
+	const int aligned = (((unsigned long)in | (unsigned long)out) & 3) == 0;
 	int i;
 
+	while (blocks--)
+	{
+		// polarssl wants the big endian byte string of the counter
+		block[0] = __builtin_bswap32(ctr->w[3]);
+		block[1] = __builtin_bswap32(ctr->w[2]);
+		block[2] = __builtin_bswap32(ctr->w[1]);
+		block[3] = __builtin_bswap32(ctr->w[0]);
+
+		aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, (unsigned char*)block, (unsigned char*)stream);
+
+		if (aligned)
+		{
+			const unsigned int* in32 = (const unsigned int*)in8;
+			unsigned int* out32 = (unsigned int*)out8;
+			out32[0] = __builtin_bswap32(stream[3]) ^ in32[0];
+			out32[1] = __builtin_bswap32(stream[2]) ^ in32[1];
+			out32[2] = __builtin_bswap32(stream[1]) ^ in32[2];
+			out32[3] = __builtin_bswap32(stream[0]) ^ in32[3];
+		}
+		else
+		{
+			for (i = 0; i < 16; i++)
+				out8[i] = ((unsigned char*)stream)[15 - i] ^ in8[i];
+		}
+
+		in8 += 16;
+		out8 += 16;
 
+		if (++ctr->w[0] == 0 && ++ctr->w[1] == 0 && ++ctr->w[2] == 0)
+			++ctr->w[3];
+	}
+}
 
+void dsi_init_ccm(dsi_context* ctx, unsigned char key[16], unsigned int maclength,
+				  unsigned int payloadlength, unsigned int assoclength, unsigned char nonce[12])
+{
 	dsi_set_key(ctx, key);
+	dsi_start_ccm(ctx, maclength, payloadlength, assoclength, nonce);
+}
+
+// same as dsi_init_ccm with the key schedule already in ctx
+void dsi_start_ccm(dsi_context* ctx, unsigned int maclength,
+				   unsigned int payloadlength, unsigned int assoclength, const unsigned char nonce[12])
+{
+	int i;
 
 	ctx->maclen = maclength;
 
@@ -184,23 +248,90 @@ void dsi_decrypt_ccm_block(dsi_context* ctx, unsigned char input[16], unsigned c
 }
 
 
-void dsi_decrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* output, unsigned int size, unsigned char* mac)
+// ctx->ctr and ctx->mac are big endian byte strings, the data is in the
+// byte reversed dsi order, so whole words are swapped around between the two
+static void dsi_ctr_from_bytes(dsi_ctr* ctr, const unsigned char ctr_be[16])
 {
-	unsigned char block[16];
-	unsigned char ctr[16];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		ctr->w[3 - i] = (ctr_be[i * 4 + 0] << 24) | (ctr_be[i * 4 + 1] << 16) |
+			(ctr_be[i * 4 + 2] << 8) | ((unsigned int)ctr_be[i * 4 + 3] << 0);
+}
+
+static void dsi_ctr_to_bytes(unsigned char ctr_be[16], const dsi_ctr* ctr)
+{
+	int i;
 
-	while (size > 16)
+	for (i = 0; i < 4; i++)
 	{
-		dsi_decrypt_ccm_block(ctx, input, output, mac);
+		ctr_be[i * 4 + 0] = ctr->w[3 - i] >> 24;
+		ctr_be[i * 4 + 1] = ctr->w[3 - i] >> 16;
+		ctr_be[i * 4 + 2] = ctr->w[3 - i] >> 8;
+		ctr_be[i * 4 + 3] = ctr->w[3 - i] >> 0;
+	}
+}
+
+// ccm over whole blocks, the keystream and the cbc-mac of each block are done
+// in the same pass so the data is only loaded once, in and out may be the same
+static void dsi_ccm_blocks(dsi_context* ctx, const unsigned char* in, unsigned char* out, unsigned int blocks, int encrypt)
+{
+	unsigned int data[4];
+	unsigned int plain[4];
+	unsigned int block[4];
+	unsigned int stream[4];
+	unsigned int mac[4];
+	dsi_ctr ctr;
+	int i;
+
+	dsi_ctr_from_bytes(&ctr, ctx->ctr);
+	memcpy(mac, ctx->mac, 16);
+
+	while (blocks--)
+	{
+		block[0] = __builtin_bswap32(ctr.w[3]);
+		block[1] = __builtin_bswap32(ctr.w[2]);
+		block[2] = __builtin_bswap32(ctr.w[1]);
+		block[3] = __builtin_bswap32(ctr.w[0]);
+		aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, (unsigned char*)block, (unsigned char*)stream);
+
+		memcpy(data, in, 16);
+		for (i = 0; i < 4; i++)
+		{
+			unsigned int crypted = data[i] ^ __builtin_bswap32(stream[3 - i]);
+			plain[i] = encrypt ? data[i] : crypted;
+			data[i] = crypted;
+		}
+		memcpy(out, data, 16);
+
+		for (i = 0; i < 4; i++)
+			mac[i] ^= __builtin_bswap32(plain[3 - i]);
+		aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, (unsigned char*)mac, (unsigned char*)mac);
 
-		if (input)
-			input += 16;
-		if (output)
-			output += 16;
+		in += 16;
+		out += 16;
 
-		size -= 16;
+		if (++ctr.w[0] == 0 && ++ctr.w[1] == 0 && ++ctr.w[2] == 0)
+			++ctr.w[3];
 	}
 
+	memcpy(ctx->mac, mac, 16);
+	dsi_ctr_to_bytes(ctx->ctr, &ctr);
+}
+
+// input and output must not be null, everything but the last block goes
+// through dsi_ccm_blocks, the possibly partial last one produces the mac
+void dsi_decrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* output, unsigned int size, unsigned char* mac)
+{
+	unsigned char block[16];
+	unsigned char ctr[16];
+	unsigned int blocks = size ? (size - 1) / 16 : 0;
+
+	dsi_ccm_blocks(ctx, input, output, blocks, 0);
+	input += blocks * 16;
+	output += blocks * 16;
+	size -= blocks * 16;
+
 	memcpy(ctr, ctx->ctr, 16);
 	memset(block, 0, 16);
 	dsi_crypt_ctr_block(ctx, block, block);
@@ -216,18 +347,12 @@ void dsi_decrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* outp
 void dsi_encrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* output, unsigned int size, unsigned char* mac)
 {
 	unsigned char block[16];
+	unsigned int blocks = size ? (size - 1) / 16 : 0;
 
-	while (size > 16)
-	{
-		dsi_encrypt_ccm_block(ctx, input, output, mac);
-
-		if (input)
-			input += 16;
-		if (output)
-			output += 16;
-
-		size -= 16;
-	}
+	dsi_ccm_blocks(ctx, input, output, blocks, 1);
+	input += blocks * 16;
+	output += blocks * 16;
+	size -= blocks * 16;
 
 	memset(block, 0, 16);
 	memcpy(block, input, size);
@@ -238,7 +363,9 @@ void dsi_encrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* outp
 void dsi_es_init(dsi_es_context* ctx, unsigned char key[16])
 {
 	memcpy(ctx->key, key, 16);
+	dsi_set_key(&ctx->crypt, key);
 	ctx->randomnonce = 1;
+	ctx->ccm = 0;
 }
 
 void dsi_es_set_nonce(dsi_es_context* ctx, unsigned char nonce[12])
@@ -260,7 +387,7 @@ int dsi_es_decrypt(dsi_es_context* ctx, unsigned char* buffer, unsigned char met
 	unsigned char scratchpad[16];
 	unsigned char chkmac[16];
 	unsigned char genmac[16];
-	dsi_context cryptoctx;
+	dsi_context* cryptoctx = &ctx->crypt;
 	unsigned int chksize;
 
 
@@ -272,8 +399,8 @@ int dsi_es_decrypt(dsi_es_context* ctx, unsigned char* buffer, unsigned char met
 	ctr[14] = 0;
 	ctr[15] = 0;
 
-	dsi_init_ctr(&cryptoctx, ctx->key, ctr);
-	dsi_crypt_ctr_block(&cryptoctx, metablock+16, scratchpad);
+	dsi_set_ctr(cryptoctx, ctr);
+	dsi_crypt_ctr_block(cryptoctx, metablock+16, scratchpad);
 
 	chksize = (scratchpad[13]<<16) | (scratchpad[14]<<8) | (scratchpad[15]<<0);
 
@@ -289,8 +416,15 @@ int dsi_es_decrypt(dsi_es_context* ctx, unsigned char* buffer, unsigned char met
 
 	memcpy(nonce, metablock + 17, 12);
 
-	dsi_init_ccm(&cryptoctx, ctx->key, 16, size, 0, nonce);
-	dsi_decrypt_ccm(&cryptoctx, buffer, buffer, size, genmac);
+	if (ctx->ccm)
+	{
+		int res = ctx->ccm(0, nonce, buffer, size, chkmac);
+		if (res <= 0)
+			return res == 0 ? 0 : -3;
+	}
+
+	dsi_start_ccm(cryptoctx, 16, size, 0, nonce);
+	dsi_decrypt_ccm(cryptoctx, buffer, buffer, size, genmac);
 
 	if (memcmp(genmac, chkmac, 16) != 0)
 	{
@@ -308,7 +442,7 @@ void dsi_es_encrypt(dsi_es_context* ctx, unsigned char* buffer, unsigned char me
 	unsigned char mac[16];
 	unsigned char ctr[16];
 	unsigned char scratchpad[16];
-	dsi_context cryptoctx;
+	dsi_context* cryptoctx = &ctx->crypt;
 
 	if (ctx->randomnonce)
 	{
@@ -322,8 +456,11 @@ void dsi_es_encrypt(dsi_es_context* ctx, unsigned char* buffer, unsigned char me
 		memcpy(nonce, ctx->nonce, 12);
 	}
 
-	dsi_init_ccm(&cryptoctx, ctx->key, 16, size, 0, nonce);
-	dsi_encrypt_ccm(&cryptoctx, buffer, buffer, size, mac);
+	if (!ctx->ccm || ctx->ccm(1, nonce, buffer, size, mac) != 0)
+	{
+		dsi_start_ccm(cryptoctx, 16, size, 0, nonce);
+		dsi_encrypt_ccm(cryptoctx, buffer, buffer, size, mac);
+	}
 
 	memset(scratchpad, 0, 16);
 	scratchpad[0] = 0x3A;
@@ -334,8 +471,8 @@ void dsi_es_encrypt(dsi_es_context* ctx, unsigned char* buffer, unsigned char me
 	memset(ctr, 0, 16);
 	memcpy(ctr+1, nonce, 12);
 
-	dsi_init_ctr(&cryptoctx, ctx->key, ctr);
-	dsi_crypt_ctr_block(&cryptoctx, scratchpad, metablock+16);
+	dsi_set_ctr(cryptoctx, ctr);
+	dsi_crypt_ctr_block(cryptoctx, scratchpad, metablock+16);
 	memcpy(metablock+17, nonce, 12);
 
 	memcpy(metablock, mac, 16);
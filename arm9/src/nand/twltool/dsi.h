@@ -14,11 +14,26 @@ typedef struct
 }
 dsi_context;
 
+// counter as native words, w[0] holds the least significant 32 bits
+typedef struct
+{
+	unsigned int w[4];
+}
+dsi_ctr;
+
 typedef struct
 {
 	unsigned char key[16];
 	unsigned char nonce[12];
 	int randomnonce;
+
+	// expanded once by dsi_es_init and reused by every block
+	dsi_context crypt;
+
+	// optional bulk ccm backend with a 16 byte mac, when encrypting it fills
+	// mac, when decrypting it checks against it. returns 0 on success, -1 on a
+	// mac mismatch and 1 if it can't handle the buffer and software should
+	int (*ccm)(int encrypt, const unsigned char nonce[12], unsigned char* buffer, unsigned int size, unsigned char mac[16]);
 } dsi_es_context;
 
 
@@ -39,9 +54,18 @@ void dsi_crypt_ctr(dsi_context* ctx, const void* in, void* out, unsigned int len
 
 void dsi_crypt_ctr_block(dsi_context* ctx, const unsigned char input[16], unsigned char output[16]);
 
+void dsi_ctr_load(dsi_ctr* ctr, const unsigned char ctr_le[16]);
+
+void dsi_ctr_add(dsi_ctr* ctr, unsigned int carry);
+
+void dsi_crypt_ctr_blocks(dsi_context* ctx, dsi_ctr* ctr, const void* in, void* out, unsigned int blocks);
+
 void dsi_init_ccm(dsi_context* ctx, unsigned char key[16], unsigned int maclength,
 				  unsigned int payloadlength, unsigned int assoclength, unsigned char nonce[12]);
 
+void dsi_start_ccm(dsi_context* ctx, unsigned int maclength,
+				   unsigned int payloadlength, unsigned int assoclength, const unsigned char nonce[12]);
+
 void dsi_encrypt_ccm_block(dsi_context* ctx, unsigned char input[16], unsigned char output[16], unsigned char* mac);
 
 void dsi_decrypt_ccm_block(dsi_context* ctx, unsigned char input[16], unsigned char output[16], unsigned char* mac);
@@ -3,98 +3,245 @@
 #include "u128_math.h"
 #include <string.h>
 
-// rotate a 128bit, little endian by shift bits in direction of increasing significance.
-void u128_lrot(uint8_t *num, uint32_t shift)
+// all the operations work on four native 32 bit words, the byte arrays are
+// little endian so on the (little endian) arm9 an aligned array is already in
+// native form and is used in place, unaligned ones go through a copy
+
+// the word view aliases the callers byte arrays
+typedef uint32_t __attribute__((may_alias)) u128_word;
+
+static inline int u128_aligned(const void *p)
 {
-	uint8_t tmp[16];
-	for (int i=0;i<16;i++)
+	return ((uintptr_t)p & 3) == 0;
+}
+
+static inline void u128_load(uint32_t *w, const uint8_t *num)
+{
+	for (int i=0;i<4;i++)
+		w[i] = num[i*4] | (num[i*4+1] << 8) | (num[i*4+2] << 16) | ((uint32_t)num[i*4+3] << 24);
+}
+
+static inline void u128_store(uint8_t *num, const uint32_t *w)
+{
+	for (int i=0;i<4;i++)
 	{
-		// rot: rotate to more significant.
-		// LSB is tmp[0], MSB is tmp[15]
-		const uint32_t byteshift = shift / 8;
-		const uint32_t bitshift = shift % 8;
-		tmp[(i+byteshift) % 16] = (num[i] << bitshift)
-			| ((num[(i+16-1) % 16] >> (8-bitshift)) & 0xff);
+		num[i*4] = w[i];
+		num[i*4+1] = w[i] >> 8;
+		num[i*4+2] = w[i] >> 16;
+		num[i*4+3] = w[i] >> 24;
 	}
-	memcpy(num, tmp, 16);
 }
 
-// rotate a 128bit, little endian by shift bits in direction of decreasing significance.
-void u128_rrot(uint8_t *num, uint32_t shift)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define U128_NATIVE(p) u128_aligned(p)
+#else
+#define U128_NATIVE(p) 0
+#endif
+
+// get a word view of num, either num itself or tmp filled from it
+static inline u128_word *u128_words(uint8_t *num, uint32_t *tmp)
 {
-	uint8_t tmp[16];
-	for (int i=0;i<16;i++)
+	if (U128_NATIVE(num))
+		return (u128_word *)num;
+	u128_load(tmp, num);
+	return tmp;
+}
+
+static inline const u128_word *u128_cwords(const uint8_t *num, uint32_t *tmp)
+{
+	if (U128_NATIVE(num))
+		return (const u128_word *)num;
+	u128_load(tmp, num);
+	return tmp;
+}
+
+static inline void u128_done(uint8_t *num, const u128_word *w)
+{
+	if ((const uint8_t *)w != num)
+		u128_store(num, w);
+}
+
+/************************ Word primitives *************************************/
+
+void u128w_lrot(uint32_t *w, uint32_t shift)
+{
+	uint32_t tmp[4];
+	const uint32_t wordshift = (shift / 32) % 4;
+	const uint32_t bitshift = shift % 32;
+	for (int i=0;i<4;i++)
 	{
-		// rot: rotate to less significant.
-		// LSB is tmp[0], MSB is tmp[15]
-		const uint32_t byteshift = shift / 8;
-		const uint32_t bitshift = shift % 8;
-		tmp[i] = (num[(i+byteshift) % 16] >> bitshift)
-			| ((num[(i+byteshift+1) % 16] << (8-bitshift)) & 0xff);
+		// LSW is w[0], MSW is w[3]
+		uint32_t lo = w[(i+4-wordshift) % 4];
+		uint32_t below = w[(i+3-wordshift) % 4];
+		tmp[i] = bitshift ? (lo << bitshift) | (below >> (32-bitshift)) : lo;
 	}
-	memcpy(num, tmp, 16);
+	memcpy(w, tmp, 16);
 }
 
-// xor two 128bit, little endian values and store the result into the first
-void u128_xor(uint8_t *a, const uint8_t *b)
+void u128w_rrot(uint32_t *w, uint32_t shift)
 {
-	for (int i=0;i<16;i++)
+	u128w_lrot(w, 128 - (shift % 128));
+}
+
+#if defined(__arm__) && !defined(__thumb__)
+
+// the carry chain in the flags, no data dependent branches
+void u128w_add(uint32_t *a, const uint32_t *b)
+{
+	uint32_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+	__asm__ ("adds %0, %0, %4\n\t"
+		"adcs %1, %1, %5\n\t"
+		"adcs %2, %2, %6\n\t"
+		"adc %3, %3, %7"
+		: "+&r"(a0), "+&r"(a1), "+&r"(a2), "+&r"(a3)
+		: "r"(b[0]), "r"(b[1]), "r"(b[2]), "r"(b[3])
+		: "cc");
+	a[0] = a0; a[1] = a1; a[2] = a2; a[3] = a3;
+}
+
+void u128w_add32(uint32_t *a, uint32_t b)
+{
+	uint32_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+	__asm__ ("adds %0, %0, %4\n\t"
+		"adcs %1, %1, #0\n\t"
+		"adcs %2, %2, #0\n\t"
+		"adc %3, %3, #0"
+		: "+&r"(a0), "+&r"(a1), "+&r"(a2), "+&r"(a3)
+		: "r"(b)
+		: "cc");
+	a[0] = a0; a[1] = a1; a[2] = a2; a[3] = a3;
+}
+
+void u128w_sub(uint32_t *a, const uint32_t *b)
+{
+	uint32_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+	__asm__ ("subs %0, %0, %4\n\t"
+		"sbcs %1, %1, %5\n\t"
+		"sbcs %2, %2, %6\n\t"
+		"sbc %3, %3, %7"
+		: "+&r"(a0), "+&r"(a1), "+&r"(a2), "+&r"(a3)
+		: "r"(b[0]), "r"(b[1]), "r"(b[2]), "r"(b[3])
+		: "cc");
+	a[0] = a0; a[1] = a1; a[2] = a2; a[3] = a3;
+}
+
+#else
+
+// the carry is computed arithmetically, so this stays branch free as well
+void u128w_add(uint32_t *a, const uint32_t *b)
+{
+	uint32_t carry = 0;
+	for (int i=0;i<4;i++)
 	{
-		a[i] = a[i] ^ b[i];
+		uint32_t sum = a[i] + b[i];
+		uint32_t c = sum < a[i];
+		a[i] = sum + carry;
+		carry = c | (a[i] < carry);
 	}
 }
 
-// or two 128bit, little endian values and store the result into the first
-void u128_or(uint8_t *a, const uint8_t *b)
+void u128w_add32(uint32_t *a, uint32_t b)
 {
-	for (int i=0;i<16;i++)
+	uint32_t carry = b;
+	for (int i=0;i<4;i++)
 	{
-		a[i] = a[i] | b[i];
+		a[i] += carry;
+		carry = a[i] < carry;
 	}
 }
 
-// and two 128bit, little endian values and store the result into the first
-void u128_and(uint8_t *a, const uint8_t *b)
+void u128w_sub(uint32_t *a, const uint32_t *b)
 {
-	for (int i=0;i<16;i++)
+	uint32_t borrow = 0;
+	for (int i=0;i<4;i++)
 	{
-		a[i] = a[i] & b[i];
+		uint32_t diff = a[i] - b[i];
+		uint32_t c = a[i] < b[i];
+		a[i] = diff - borrow;
+		borrow = c | (diff < borrow);
 	}
 }
 
+#endif
+
+/************************ Byte array interface ********************************/
+
+// rotate a 128bit, little endian by shift bits in direction of increasing significance.
+void u128_lrot(uint8_t *num, uint32_t shift)
+{
+	uint32_t tmp[4];
+	u128_word *w = u128_words(num, tmp);
+	u128w_lrot(w, shift);
+	u128_done(num, w);
+}
+
+// rotate a 128bit, little endian by shift bits in direction of decreasing significance.
+void u128_rrot(uint8_t *num, uint32_t shift)
+{
+	uint32_t tmp[4];
+	u128_word *w = u128_words(num, tmp);
+	u128w_rrot(w, shift);
+	u128_done(num, w);
+}
+
+// xor two 128bit, little endian values and store the result into the first
+void u128_xor(uint8_t *a, const uint8_t *b)
+{
+	uint32_t ta[4], tb[4];
+	u128_word *wa = u128_words(a, ta);
+	const u128_word *wb = u128_cwords(b, tb);
+	for (int i=0;i<4;i++)
+		wa[i] ^= wb[i];
+	u128_done(a, wa);
+}
+
+// or two 128bit, little endian values and store the result into the first
+void u128_or(uint8_t *a, const uint8_t *b)
+{
+	uint32_t ta[4], tb[4];
+	u128_word *wa = u128_words(a, ta);
+	const u128_word *wb = u128_cwords(b, tb);
+	for (int i=0;i<4;i++)
+		wa[i] |= wb[i];
+	u128_done(a, wa);
+}
+
+// and two 128bit, little endian values and store the result into the first
+void u128_and(uint8_t *a, const uint8_t *b)
+{
+	uint32_t ta[4], tb[4];
+	u128_word *wa = u128_words(a, ta);
+	const u128_word *wb = u128_cwords(b, tb);
+	for (int i=0;i<4;i++)
+		wa[i] &= wb[i];
+	u128_done(a, wa);
+}
 
 // add two 128bit, little endian values and store the result into the first
 void u128_add(uint8_t *a, const uint8_t *b)
 {
-	uint8_t carry = 0;
-	for (int i=0;i<16;i++)
-	{
-		uint16_t sum = a[i] + b[i] + carry;
-		a[i] = sum & 0xff;
-		carry = sum >> 8;
-	}
+	uint32_t ta[4], tb[4];
+	u128_word *wa = u128_words(a, ta);
+	u128w_add(wa, u128_cwords(b, tb));
+	u128_done(a, wa);
 }
 
-// add two 128bit, little endian values and store the result into the first
+// add a 32 bit value to a 128bit, little endian value
 void u128_add32(uint8_t *a, const uint32_t b)
 {
-	uint8_t _b[16];
-	memset(_b, 0, sizeof(_b));
-	for (int i=0;i<4;i++)
-		_b[i] = b >> (i*8);
-	u128_add(a, _b);
+	uint32_t ta[4];
+	u128_word *wa = u128_words(a, ta);
+	u128w_add32(wa, b);
+	u128_done(a, wa);
 }
 
 // sub two 128bit, little endian values and store the result into the first
 void u128_sub(uint8_t *a, const uint8_t *b)
 {
-	uint8_t carry = 0;
-	for (int i=0;i<16;i++)
-	{
-		uint16_t sub = a[i] - b[i] - (carry & 1);
-		a[i] = sub & 0xff;
-		carry = sub >> 8;
-	}
+	uint32_t ta[4], tb[4];
+	u128_word *wa = u128_words(a, ta);
+	u128w_sub(wa, u128_cwords(b, tb));
+	u128_done(a, wa);
 }
 
 void u128_swap(uint8_t *out, const uint8_t *in)
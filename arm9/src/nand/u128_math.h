@@ -33,6 +33,15 @@ void u128_sub(uint8_t *a, const uint8_t *b);
 // swap byte order
 void u128_swap(uint8_t *out, const uint8_t *in);
 
+// the same operations on a value held as four native words, least
+// significant first, for callers that keep their numbers in that form.
+// none of them branch on the data
+void u128w_lrot(uint32_t *w, uint32_t shift);
+void u128w_rrot(uint32_t *w, uint32_t shift);
+void u128w_add(uint32_t *a, const uint32_t *b);
+void u128w_add32(uint32_t *a, uint32_t b);
+void u128w_sub(uint32_t *a, const uint32_t *b);
+
 #ifdef __cplusplus
 }
 #endif
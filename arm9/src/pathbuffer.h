@@ -0,0 +1,57 @@
+#ifndef PATHBUFFER_H
+#define PATHBUFFER_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <dirent.h>
+#include <format>
+#include <memory>
+#include <string_view>
+
+// enough for nand:/title/00030017/484e4145/content/00000001.app and friends
+static constexpr size_t PATH_BUFFER_SIZE = 64;
+
+// a nul terminated path built in place, format() says so instead of
+// allocating when the result doesn't fit
+template<size_t N = PATH_BUFFER_SIZE>
+class PathBuffer {
+public:
+	template<typename... Args>
+	bool format(std::format_string<Args...> fmt, Args&&... args)
+	{
+		auto result = std::format_to_n(buffer.data(), N - 1, fmt, args...);
+		length = std::min(static_cast<size_t>(result.size), N - 1);
+		buffer[length] = '\0';
+		return static_cast<size_t>(result.size) < N;
+	}
+
+	const char* data() const
+	{
+		return buffer.data();
+	}
+
+	std::string_view view() const
+	{
+		return {buffer.data(), length};
+	}
+
+	operator std::string_view() const
+	{
+		return view();
+	}
+private:
+	std::array<char, N> buffer{};
+	size_t length{0};
+};
+
+// closes the directory when it goes out of scope, nothing on the heap
+struct DirCloser {
+	void operator()(DIR* dir) const
+	{
+		closedir(dir);
+	}
+};
+using DirHandle = std::unique_ptr<DIR, DirCloser>;
+
+#endif
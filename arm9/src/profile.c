@@ -0,0 +1,112 @@
+#include "profile.h"
+
+#ifdef NAND_PROFILE
+
+#include <nds.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include "message.h"
+#include "nand/sdmmc_queue.h"
+
+#define PROFILE_TIMER  2
+#define PROFILE_PATH   "sd:/launcher-tmd-restorer-profile.txt"
+
+typedef struct {
+	u32 calls;
+	u32 sectors;
+	u64 bytes;
+	u64 ticks;
+} ProfileCounter;
+
+static ProfileCounter counters[PROFILE_SLOTS];
+static SdmmcProfile* sdmmcProfile = NULL;
+
+static const char* const slotNames[PROFILE_SLOTS] = {
+	"nand read",
+	"nand write",
+	"nand crypt",
+	"fat sync",
+	"sha1",
+};
+
+void profileInit()
+{
+	cpuStartTiming(PROFILE_TIMER);
+
+	// the arm7 writes to it behind the cache's back
+	void* mem = memalign(32, (sizeof(SdmmcProfile) + 31) & ~31);
+	if (mem)
+	{
+		DC_InvalidateRange(mem, (sizeof(SdmmcProfile) + 31) & ~31);
+		sdmmcProfile = (SdmmcProfile*)memUncached(mem);
+		sdmmcProfile->calls = 0;
+		sdmmcProfile->sectors = 0;
+		sdmmcProfile->bytes = 0;
+		sdmmcProfile->ticks = 0;
+		fifoSendAddress(FIFO_SDMMC_PROFILE, mem);
+	}
+}
+
+u32 profileStart()
+{
+	return cpuGetTiming();
+}
+
+void profileStop(ProfileSlot slot, u32 start, u32 bytes, u32 sectors)
+{
+	ProfileCounter* counter = &counters[slot];
+	counter->ticks += cpuGetTiming() - start;
+	counter->calls++;
+	counter->bytes += bytes;
+	counter->sectors += sectors;
+}
+
+// the console is 32 columns wide, it goes without the sector count
+static void dumpRow(FILE* out, bool compact, const char* name, u32 calls, u32 sectors, u64 bytes, u64 ticks)
+{
+	unsigned long ms = ticks / (BUS_CLOCK / 1000);
+	unsigned long kib = bytes / 1024;
+	// KiB/s, 0 when it was too quick to tell
+	unsigned long rate = ms ? bytes * 1000 / 1024 / ms : 0;
+	if (compact)
+		fprintf(out, "%-9.9s%5lu%6lu%6lu%6lu", name, (unsigned long)calls, kib, ms, rate);
+	else
+		fprintf(out, "%-12s %6lu %7lu %7lu %6lu %6lu\n", name, (unsigned long)calls, (unsigned long)sectors, kib, ms, rate);
+}
+
+static void dump(FILE* out, bool compact)
+{
+	if (compact)
+		fprintf(out, "%-9s%5s%6s%6s%6s", "", "calls", "KiB", "ms", "KiB/s");
+	else
+		fprintf(out, "%-12s %6s %7s %7s %6s %6s\n", "", "calls", "sectors", "KiB", "ms", "KiB/s");
+	for (int i = 0; i < PROFILE_SLOTS; i++)
+	{
+		const ProfileCounter* counter = &counters[i];
+		dumpRow(out, compact, slotNames[i], counter->calls, counter->sectors, counter->bytes, counter->ticks);
+	}
+	if (sdmmcProfile)
+		dumpRow(out, compact, "arm7 sdmmc", sdmmcProfile->calls, sdmmcProfile->sectors, sdmmcProfile->bytes, sdmmcProfile->ticks);
+}
+
+void profileDump(FILE* out)
+{
+	dump(out, false);
+}
+
+void profileReport()
+{
+	dump(stdout, true);
+
+	FILE* out = fopen(PROFILE_PATH, "w");
+	if (out)
+	{
+		profileDump(out);
+		fclose(out);
+	}
+
+	printf("\nPress A to exit");
+	keyWait(KEY_A);
+}
+
+#endif
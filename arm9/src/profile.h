@@ -0,0 +1,41 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <nds/ndstypes.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	PROFILE_NAND_READ,
+	PROFILE_NAND_WRITE,
+	PROFILE_NAND_CRYPT,
+	PROFILE_FAT_SYNC,
+	PROFILE_SHA1,
+	PROFILE_SLOTS
+} ProfileSlot;
+
+// everything compiles away unless built with make PROFILE=1
+#ifdef NAND_PROFILE
+void profileInit();
+u32 profileStart();
+void profileStop(ProfileSlot slot, u32 start, u32 bytes, u32 sectors);
+// one row per slot, the arm7's sdmmc commands go last
+void profileDump(FILE* out);
+// prints the table, saves it to the sd card and waits for A
+void profileReport();
+#else
+static inline void profileInit() {}
+static inline u32 profileStart() { return 0; }
+static inline void profileStop(ProfileSlot slot, u32 start, u32 bytes, u32 sectors) {}
+static inline void profileDump(FILE* out) {}
+static inline void profileReport() {}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
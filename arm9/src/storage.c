@@ -1,56 +1,15 @@
 #include "storage.h"
 #include "main.h"
 #include "message.h"
+#include "profile.h"
+#include "ui.h"
+#include "arena.h"
 #include <errno.h>
 #include <nds/sha1.h>
 #include <dirent.h>
 
 #define TITLE_LIMIT 39
 
-//progress bar
-static int lastBars = 0;
-
-static void printProgressBar(float percent)
-{
-	if (percent < 0.f) percent = 0.f;
-	if (percent > 1.f) percent = 1.f;
-
-	int bars = (int)(30.f * percent);
-
-	//skip redundant prints
-	if (bars != lastBars)
-	{
-		consoleSelect(&topScreen);
-
-		iprintf("\x1B[42m");	//green
-
-		//Print frame
-		if (lastBars <= 0)
-		{
-			iprintf("\x1b[23;0H[");
-			iprintf("\x1b[23;31H]");
-		}
-
-		//Print bars
-		if (bars > 0)
-		{
-			for (int i = 0; i < bars; i++)
-				iprintf("\x1b[23;%dH|", 1 + i);
-		}
-
-		lastBars = bars;
-
-		iprintf("\x1B[47m");	//white
-	}
-}
-
-static void clearProgressBar()
-{
-	lastBars = 0;
-	consoleSelect(&topScreen);
-	iprintf("\x1b[23;0H                                ");
-}
-
 //files
 bool fileExists(char const* path)
 {
@@ -65,70 +24,104 @@ int copyFile(char const* src, char const* dst)
 	return copyFilePart(src, 0, size, dst);
 }
 
-int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
+// whole sectors and cache lines, so the nand/sd drivers can move it in one go
+#define COPY_BUFF_SIZE (32 * 1024)
+// let a frame go by after this many frames of copying, so the rest of the
+// system doesn't stall behind a long transfer
+#define YIELD_FRAMES 16
+
+// returns how many bytes were copied, fout and sha are both optional so the
+// same pass can copy, hash, or both
+static u32 copyStream(FILE* fin, FILE* fout, u32 size, char* buffer, swiSHA1context_t* sha)
 {
-	if (!src) return 1;
-	if (!dst) return 2;
+	// small files are done before a bar would even show up
+	bool progress = size > COPY_BUFF_SIZE;
+	u32 totalBytesRead = 0;
+	u32 lastYield = vblankCount;
 
-	FILE* fin = fopen(src, "rb");
+	if (progress)
+		uiSetProgress(0, size);
 
-	if (!fin)
-	{
-		fclose(fin);
-		return 3;
-	}
-	else
+	while (!programEnd && totalBytesRead < size)
 	{
-		if (fileExists(dst))
-			remove(dst);
+		size_t toRead = COPY_BUFF_SIZE;
+		if (size - totalBytesRead < COPY_BUFF_SIZE)
+			toRead = size - totalBytesRead;
 
-		FILE* fout = fopen(dst, "wb");
+		size_t bytesRead = fread(buffer, 1, toRead, fin);
+		if (bytesRead == 0)
+			break;
+		if (sha)
+			swiSHA1Update(sha, buffer, bytesRead);
+		if (fout && fwrite(buffer, bytesRead, 1, fout) != 1)
+			break;
 
-		if (!fout)
+		totalBytesRead += bytesRead;
+
+		// the bar itself is drawn on vblank
+		if (progress)
+			uiSetProgress(totalBytesRead, size);
+
+		if (vblankCount - lastYield >= YIELD_FRAMES)
 		{
-			fclose(fin);
-			fclose(fout);
-			return 4;
+			swiWaitForVBlank();
+			lastYield = vblankCount;
 		}
-		else
-		{
-			fseek(fin, offset, SEEK_SET);
 
-			consoleSelect(&topScreen);
-
-			int bytesRead;
-			unsigned long long totalBytesRead = 0;
+		if (bytesRead != toRead)
+			break;
+	}
 
-			#define BUFF_SIZE 128 //Arbitrary. A value too large freezes the ds.
-			char* buffer = (char*)malloc(BUFF_SIZE);
+	return totalBytesRead;
+}
 
-			while (!programEnd)
-			{
-				unsigned int toRead = BUFF_SIZE;
-				if (size - totalBytesRead < BUFF_SIZE)
-					toRead = size - totalBytesRead;
+int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
+{
+	if (!src) return 1;
+	if (!dst) return 2;
 
-				bytesRead = fread(buffer, 1, toRead, fin);
-				fwrite(buffer, bytesRead, 1, fout);
+	FILE* fin = fopen(src, "rb");
 
-				totalBytesRead += bytesRead;
-				printProgressBar( ((float)totalBytesRead / (float)size) );
+	if (!fin)
+	{
+		return 3;
+	}
 
-				if (bytesRead != BUFF_SIZE)
-					break;
-			}
+	if (fileExists(dst))
+		remove(dst);
 
-			clearProgressBar();
-			consoleSelect(&bottomScreen);
+	FILE* fout = fopen(dst, "wb");
 
-			free(buffer);
-		}
+	if (!fout)
+	{
+		fclose(fin);
+		return 4;
+	}
 
+	ArenaMark mark = arenaMark();
+	char* buffer = (char*)arenaAlloc(COPY_BUFF_SIZE);
+	if (!buffer)
+	{
 		fclose(fout);
+		fclose(fin);
+		return 5;
 	}
 
+	// we feed whole buffers ourselves, stdio's own copy would just be in the way
+	setvbuf(fin, NULL, _IONBF, 0);
+	setvbuf(fout, NULL, _IONBF, 0);
+	fseek(fin, offset, SEEK_SET);
+
+	u32 copied = copyStream(fin, fout, size, buffer, NULL);
+	uiClearProgress();
+
+	arenaReset(mark);
+
+	int ret = 0;
+	if (fclose(fout) != 0 || (copied != size && !programEnd))
+		ret = 6;
 	fclose(fin);
-	return 0;
+	return ret;
 }
 
 unsigned long long getFileSize(FILE* f)
@@ -179,17 +172,26 @@ bool writeToFile(FILE* fd, const char* buffer, size_t size)
 bool calculateFileSha1(FILE* f, void* digest)
 {
 	fseek(f, 0, SEEK_SET);
-	
+
+	ArenaMark mark = arenaMark();
+	char* buffer = (char*)arenaAlloc(COPY_BUFF_SIZE);
+	if (!buffer)
+		return false;
+
+	u32 timing = profileStart();
 	swiSHA1context_t ctx;
 	ctx.sha_block = 0; //this is weird but it has to be done
 	swiSHA1Init(&ctx);
-	
-	char buffer[512];	
+
 	size_t n = 0;
-	while ((n = fread(buffer, sizeof(char), sizeof(buffer), f)) > 0)
+	u32 total = 0;
+	while ((n = fread(buffer, sizeof(char), COPY_BUFF_SIZE, f)) > 0)
 	{
 		swiSHA1Update(&ctx, buffer, n);
+		total += n;
 	}
+	profileStop(PROFILE_SHA1, timing, total, 0);
+	arenaReset(mark);
 	if (ferror(f) || !feof(f))
 	{
 		return false;
@@ -198,16 +200,59 @@ bool calculateFileSha1(FILE* f, void* digest)
 	return true;
 }
 
-bool calculateFileSha1Path(const char* path, void* digest)
+bool copyFileSha1(char const* src, char const* dst, void* digest)
 {
-	FILE* targetFile = fopen(path, "rb");
-	if (!targetFile)
-	{
+	if (!src) return false;
+
+	FILE* fin = fopen(src, "rb");
+	if (!fin)
 		return false;
-	}	
-	bool res = calculateFileSha1(targetFile, digest);
-	fclose(targetFile);
-	return res;
+
+	FILE* fout = NULL;
+	if (dst)
+	{
+		if (fileExists(dst))
+			remove(dst);
+		fout = fopen(dst, "wb");
+		if (!fout)
+		{
+			fclose(fin);
+			return false;
+		}
+		setvbuf(fout, NULL, _IONBF, 0);
+	}
+	setvbuf(fin, NULL, _IONBF, 0);
+
+	ArenaMark mark = arenaMark();
+	char* buffer = (char*)arenaAlloc(COPY_BUFF_SIZE);
+	bool ok = buffer != NULL;
+	if (ok)
+	{
+		u32 size = getFileSize(fin);
+
+		swiSHA1context_t ctx;
+		ctx.sha_block = 0; //this is weird but it has to be done
+		swiSHA1Init(&ctx);
+
+		u32 timing = profileStart();
+		ok = copyStream(fin, fout, size, buffer, &ctx) == size && !ferror(fin);
+		profileStop(PROFILE_SHA1, timing, size, 0);
+		uiClearProgress();
+
+		if (ok)
+			swiSHA1Final(digest, &ctx);
+	}
+	arenaReset(mark);
+
+	if (fout && fclose(fout) != 0)
+		ok = false;
+	fclose(fin);
+	return ok;
+}
+
+bool calculateFileSha1Path(const char* path, void* digest)
+{
+	return copyFileSha1(path, NULL, digest);
 }
 
 bool safeCreateDir(const char* path)
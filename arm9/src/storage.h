@@ -18,6 +18,8 @@ bool toggleFileReadOnly(const char* path, bool readOnly);
 bool writeToFile(FILE* fd, const char* buffer, size_t size);
 bool calculateFileSha1(FILE* f, void* digest);
 bool calculateFileSha1Path(const char* path, void* digest);
+// hashes src in a single pass, copying it to dst on the way unless dst is NULL
+bool copyFileSha1(char const* src, char const* dst, void* digest);
 
 //Directories
 bool safeCreateDir(const char* path);
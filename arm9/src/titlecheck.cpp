@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <dirent.h>
+#include <format>
+#include <string_view>
+
+#include "titlecheck.h"
+#include "pathbuffer.h"
+#include "storage.h"
+#include "nand/tmdsig.h"
+#include "nand/nandhash.h"
+
+// offset of the first content record, past tmd_header_v0_t
+static constexpr size_t TMD_CONTENT_ID_OFFSET = 0x1E4;
+static constexpr size_t TMD_TITLE_ID_OFFSET = 0x18C;
+static constexpr size_t TMD_CONTENT_COUNT_OFFSET = 0x1DE;
+// content record: id, index, type, 64 bit size, sha1
+static constexpr size_t TMD_CONTENT_RECORD_SIZE = 0x24;
+static constexpr size_t TMD_CONTENT_SIZE_OFFSET = 0x08;
+static constexpr size_t TMD_CONTENT_HASH_OFFSET = 0x10;
+// anything bigger can't be a tmd of a system title
+static constexpr size_t TMD_MAX_SIZE = 0x1000;
+
+static uint32_t readBe32(const uint8_t* p)
+{
+	return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+
+static bool parseHex(std::string_view str, uint32_t& out)
+{
+	auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), out, 16);
+	return ec == std::errc{} && ptr == str.data() + str.size();
+}
+
+// content ids of the .app files found in a title's content folder
+static std::vector<uint32_t> presentContents(std::string_view contentPath)
+{
+	std::vector<uint32_t> ret;
+	PathBuffer dirPath;
+	if(!dirPath.format("{}", contentPath))
+		return ret;
+	DirHandle pdir{opendir(dirPath.data())};
+	if(!pdir)
+		return ret;
+	dirent* pent;
+	while((pent = readdir(pdir.get())) != nullptr) {
+		std::string_view filename{pent->d_name};
+		uint32_t contentId;
+		if(pent->d_type != DT_DIR && filename.size() == 12 && filename.ends_with(".app")
+		   && parseHex(filename.substr(0, 8), contentId))
+			ret.push_back(contentId);
+	}
+	return ret;
+}
+
+static uint32_t catalogueContentId(const TmdCatalogueEntry& entry)
+{
+	auto tmd = decodeCatalogueTmd(entry);
+	return readBe32(tmd.data() + TMD_CONTENT_ID_OFFSET);
+}
+
+// empty if it can't be read or is too short to hold a content record
+static std::vector<uint8_t> readTmd(std::string_view contentPath)
+{
+	// one more than the limit so oversized files fail the length check,
+	// kept off the stack as that lives in dtcm
+	std::vector<uint8_t> tmd(TMD_MAX_SIZE + 1);
+	PathBuffer tmdPath;
+	if(!tmdPath.format("{}/title.tmd", contentPath))
+		return {};
+	auto* file = fopen(tmdPath.data(), "rb");
+	if(!file)
+		return {};
+	auto size = fread(tmd.data(), 1, tmd.size(), file);
+	fclose(file);
+
+	if(size < TMD_CONTENT_ID_OFFSET + TMD_CONTENT_RECORD_SIZE)
+		return {};
+	tmd.resize(size);
+	return tmd;
+}
+
+bool isSignedTmd(std::string_view contentPath, uint32_t tidHigh, uint32_t tidLow)
+{
+	auto tmd = readTmd(contentPath);
+	if(tmd.empty() || !tmdsig_verify(tmd.data(), tmd.size()))
+		return false;
+	if(readBe32(tmd.data() + TMD_TITLE_ID_OFFSET) != tidHigh || readBe32(tmd.data() + TMD_TITLE_ID_OFFSET + 4) != tidLow)
+		return false;
+	auto contents = presentContents(contentPath);
+	return std::ranges::find(contents, readBe32(tmd.data() + TMD_CONTENT_ID_OFFSET)) != contents.end();
+}
+
+static TitleCheck checkTitle(uint32_t tidHigh, uint32_t tidLow)
+{
+	auto contentPath = std::format("nand:/title/{:08x}/{:08x}/content", tidHigh, tidLow);
+	TitleCheck ret{tidHigh, tidLow, std::format("{}/title.tmd", contentPath), TitleStatus::Unknown, nullptr};
+
+	Sha1Digest digest;
+	if(!calculateFileSha1Path(ret.tmdPath.c_str(), digest.data())) {
+		ret.status = TitleStatus::Unreadable;
+	}
+
+	auto candidates = findCatalogueTmds(tidHigh, tidLow);
+	if(ret.status != TitleStatus::Unreadable) {
+		for(const auto& entry : candidates) {
+			if(entry.digest == digest) {
+				ret.status = TitleStatus::Ok;
+				ret.expected = &entry;
+				return ret;
+			}
+		}
+		// a version the catalogue doesn't know about, or a title it doesn't cover
+		if(isSignedTmd(contentPath, tidHigh, tidLow)) {
+			ret.status = TitleStatus::Ok;
+			return ret;
+		}
+		if(!candidates.empty())
+			ret.status = TitleStatus::Mismatch;
+	}
+	if(candidates.empty())
+		return ret;
+
+	// the tmd may be garbage, go by which content is actually installed
+	auto contents = presentContents(contentPath);
+	for(const auto& entry : candidates) {
+		if(std::ranges::find(contents, catalogueContentId(entry)) != contents.end()) {
+			ret.expected = &entry;
+			break;
+		}
+	}
+	return ret;
+}
+
+std::vector<TitleCheck> checkLauncherTitles()
+{
+	std::vector<TitleCheck> ret;
+	// the catalogue has nothing else, any other title would only come out unknown
+	PathBuffer typePath;
+	typePath.format("nand:/title/{:08x}", CATALOGUE_TID_HIGH);
+	DirHandle pdir{opendir(typePath.data())};
+	if(!pdir)
+		return ret;
+	dirent* pent;
+	while((pent = readdir(pdir.get())) != nullptr) {
+		uint32_t tidLow;
+		std::string_view name{pent->d_name};
+		if(pent->d_type != DT_DIR || name.size() != 8 || !parseHex(name, tidLow))
+			continue;
+		ret.push_back(checkTitle(CATALOGUE_TID_HIGH, tidLow));
+	}
+	return ret;
+}
+
+std::vector<ContentCheck> checkTitleContents(uint32_t tidHigh, uint32_t tidLow)
+{
+	std::vector<ContentCheck> ret;
+	auto contentPath = std::format("nand:/title/{:08x}/{:08x}/content", tidHigh, tidLow);
+	auto tmd = readTmd(contentPath);
+	if(tmd.empty())
+		return ret;
+
+	size_t count = (size_t{tmd[TMD_CONTENT_COUNT_OFFSET]} << 8) | tmd[TMD_CONTENT_COUNT_OFFSET + 1];
+	count = std::min(count, (tmd.size() - TMD_CONTENT_ID_OFFSET) / TMD_CONTENT_RECORD_SIZE);
+	for(size_t i = 0; i < count; ++i) {
+		const uint8_t* record = tmd.data() + TMD_CONTENT_ID_OFFSET + i * TMD_CONTENT_RECORD_SIZE;
+		auto contentId = readBe32(record);
+		ContentCheck check{contentId, std::format("{}/{:08x}.app", contentPath, contentId), TitleStatus::Ok};
+
+		Sha1Digest digest, expected;
+		std::copy_n(record + TMD_CONTENT_HASH_OFFSET, SHA1_LEN, expected.data());
+		uint64_t expectedSize = (uint64_t{readBe32(record + TMD_CONTENT_SIZE_OFFSET)} << 32)
+								| readBe32(record + TMD_CONTENT_SIZE_OFFSET + 4);
+		uint32_t size;
+		if(!nandhash_sha1_file(check.appPath.c_str(), digest.data(), &size))
+			check.status = TitleStatus::Unreadable;
+		else if(size != expectedSize || digest != expected)
+			check.status = TitleStatus::Mismatch;
+		ret.push_back(std::move(check));
+	}
+	return ret;
+}
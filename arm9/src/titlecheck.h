@@ -0,0 +1,45 @@
+#ifndef TITLECHECK_H
+#define TITLECHECK_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tmdcatalogue.h"
+
+enum class TitleStatus {
+	Ok,         // matches a catalogue tmd or is validly signed
+	Mismatch,   // doesn't match, expected says what it should be if we know
+	Unknown,    // the catalogue has nothing for this title
+	Unreadable, // no title.tmd or it couldn't be read
+};
+
+struct TitleCheck {
+	uint32_t tidHigh;
+	uint32_t tidLow;
+	std::string tmdPath;
+	TitleStatus status;
+	const TmdCatalogueEntry* expected;
+};
+
+struct ContentCheck {
+	uint32_t contentId;
+	std::string appPath;
+	TitleStatus status; // Mismatch on a wrong hash or size, Unreadable if missing
+};
+
+// true when contentPath/title.tmd carries a valid signature, is for this
+// title and its boot content is installed
+bool isSignedTmd(std::string_view contentPath, uint32_t tidHigh, uint32_t tidLow);
+
+// hashes the title.tmd of every launcher under nand:/title/00030017 (all the
+// catalogue knows) and compares it with the catalogue, the expected tmd of a
+// mismatching title is the one whose boot content is present
+std::vector<TitleCheck> checkLauncherTitles();
+
+// hashes every .app listed in the title's title.tmd and compares it with its
+// content record, empty if the tmd can't be read
+std::vector<ContentCheck> checkTitleContents(uint32_t tidHigh, uint32_t tidLow);
+
+#endif
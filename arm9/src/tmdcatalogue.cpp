@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "tmdcatalogue.h"
+#include "tmd_catalogue.h"
+
+static constexpr bool entryLess(const TmdCatalogueEntry& lhs, const TmdCatalogueEntry& rhs)
+{
+	return lhs.tid < rhs.tid || (lhs.tid == rhs.tid && lhs.version < rhs.version);
+}
+
+static_assert(std::is_sorted(std::begin(tmdCatalogue), std::end(tmdCatalogue), entryLess),
+			  "the tmd catalogue has to be sorted by tid and version");
+
+const TmdCatalogueEntry* findCatalogueTmd(uint32_t tid, uint16_t version)
+{
+	auto it = std::lower_bound(std::begin(tmdCatalogue), std::end(tmdCatalogue), std::pair{tid, version},
+							   [](const TmdCatalogueEntry& entry, const std::pair<uint32_t, uint16_t>& key) {
+		return entry.tid < key.first || (entry.tid == key.first && entry.version < key.second);
+	});
+	if(it == std::end(tmdCatalogue) || it->tid != tid || it->version != version)
+		return nullptr;
+	return &*it;
+}
+
+std::span<const TmdCatalogueEntry> findCatalogueTmds(uint32_t tidHigh, uint32_t tidLow)
+{
+	if(tidHigh != CATALOGUE_TID_HIGH)
+		return {};
+	auto [first, last] = std::equal_range(std::begin(tmdCatalogue), std::end(tmdCatalogue), TmdCatalogueEntry{tidLow, 0, {}, 0, 0},
+										  [](const TmdCatalogueEntry& lhs, const TmdCatalogueEntry& rhs) {
+		return lhs.tid < rhs.tid;
+	});
+	return {first, last};
+}
+
+TmdDeltaReader::TmdDeltaReader(const TmdCatalogueEntry& entry)
+	: runs(tmdCatalogueDeltas + entry.deltaOffset), runsEnd(runs + entry.deltaSize)
+{
+}
+
+size_t TmdDeltaReader::read(uint8_t* out, size_t len)
+{
+	size_t written = 0;
+	while(written < len && pos < TMD_SIZE) {
+		if(sameLeft == 0 && literalLeft == 0) {
+			if(runsEnd - runs >= 2) {
+				sameLeft = runs[0];
+				literalLeft = runs[1];
+				runs += 2;
+			} else {
+				// past the last run everything matches the base
+				sameLeft = TMD_SIZE - pos;
+			}
+		}
+		auto fromBase = sameLeft != 0;
+		auto chunk = std::min({len - written, TMD_SIZE - pos, fromBase ? sameLeft : literalLeft});
+		if(fromBase) {
+			std::memcpy(out + written, tmdCatalogueBase + pos, chunk);
+			sameLeft -= chunk;
+		} else {
+			std::memcpy(out + written, runs, chunk);
+			runs += chunk;
+			literalLeft -= chunk;
+		}
+		pos += chunk;
+		written += chunk;
+	}
+	return written;
+}
+
+std::array<uint8_t, TMD_SIZE> decodeCatalogueTmd(const TmdCatalogueEntry& entry)
+{
+	std::array<uint8_t, TMD_SIZE> ret{};
+	TmdDeltaReader reader{entry};
+	size_t done = 0;
+	while(done < ret.size()) {
+		auto read = reader.read(ret.data() + done, ret.size() - done);
+		if(read == 0)
+			break;
+		done += read;
+	}
+	return ret;
+}
@@ -0,0 +1,46 @@
+#ifndef TMDCATALOGUE_H
+#define TMDCATALOGUE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "sha1digest.h"
+
+static constexpr size_t TMD_SIZE = 520;
+// the catalogue only holds launchers, their tid is only the low word
+static constexpr uint32_t CATALOGUE_TID_HIGH = 0x00030017;
+
+// one known good launcher tmd, the table itself is generated from nitrofiles/
+// the tmd is stored as runs against a shared base, see tools/gen_tmd_catalogue.sh
+struct TmdCatalogueEntry {
+	uint32_t tid;
+	uint16_t version;
+	Sha1Digest digest;
+	uint32_t deltaOffset;
+	uint32_t deltaSize;
+};
+
+const TmdCatalogueEntry* findCatalogueTmd(uint32_t tid, uint16_t version);
+// every version the catalogue has for a title, sorted by version, empty for
+// anything outside CATALOGUE_TID_HIGH
+std::span<const TmdCatalogueEntry> findCatalogueTmds(uint32_t tidHigh, uint32_t tidLow);
+
+// unpacks a catalogue tmd in as many pieces as the caller likes
+class TmdDeltaReader {
+public:
+	explicit TmdDeltaReader(const TmdCatalogueEntry& entry);
+	// returns how many bytes were written to out, 0 once the whole tmd was read
+	size_t read(uint8_t* out, size_t len);
+private:
+	const uint8_t* runs;
+	const uint8_t* runsEnd;
+	size_t pos{0};
+	size_t sameLeft{0};
+	size_t literalLeft{0};
+};
+
+std::array<uint8_t, TMD_SIZE> decodeCatalogueTmd(const TmdCatalogueEntry& entry);
+
+#endif
@@ -0,0 +1,76 @@
+#include "ui.h"
+#include "main.h"
+
+#define PROGRESS_ROW  23
+#define PROGRESS_BARS 30
+
+static u16 palettes[UI_COLORS];
+
+static volatile u32 progressDone = 0;
+static volatile u32 progressTotal = 0;
+static volatile bool progressShown = false;
+// bars currently on screen, -1 when the frame isn't drawn either
+static int drawnBars = -1;
+
+void uiInit()
+{
+	// let the console parse the escapes once and remember what it ends up with
+	PrintConsole* old = consoleSelect(&topScreen);
+	iprintf("\x1B[42m");
+	palettes[UI_GREEN] = topScreen.fontCurPal;
+	iprintf("\x1B[47m");
+	palettes[UI_WHITE] = topScreen.fontCurPal;
+	consoleSelect(old);
+}
+
+void uiPutChar(PrintConsole* console, int row, int col, char c, UiColor color)
+{
+	console->fontBgMap[col + console->windowX + (row + console->windowY) * 32] =
+		palettes[color] | (u16)(c + console->fontCharOffset - console->font.asciiOffset);
+}
+
+void uiSetProgress(u32 done, u32 total)
+{
+	progressTotal = total;
+	progressDone = done;
+	progressShown = true;
+}
+
+void uiClearProgress()
+{
+	progressShown = false;
+}
+
+void uiVBlank()
+{
+	int bars = -1;
+	if (progressShown)
+	{
+		u32 total = progressTotal;
+		u32 done = progressDone;
+		bars = total == 0 || done >= total ? PROGRESS_BARS : (int)((u64)done * PROGRESS_BARS / total);
+	}
+	if (bars == drawnBars)
+		return;
+
+	if (bars < 0)
+	{
+		for (int i = 0; i < PROGRESS_BARS + 2; i++)
+			uiPutChar(&topScreen, PROGRESS_ROW, i, ' ', UI_WHITE);
+	}
+	else
+	{
+		if (drawnBars < 0)
+		{
+			uiPutChar(&topScreen, PROGRESS_ROW, 0, '[', UI_GREEN);
+			uiPutChar(&topScreen, PROGRESS_ROW, PROGRESS_BARS + 1, ']', UI_GREEN);
+			drawnBars = 0;
+		}
+		// only the cells between the old and the new length change
+		for (int i = drawnBars; i < bars; i++)
+			uiPutChar(&topScreen, PROGRESS_ROW, 1 + i, '|', UI_GREEN);
+		for (int i = bars; i < drawnBars; i++)
+			uiPutChar(&topScreen, PROGRESS_ROW, 1 + i, ' ', UI_WHITE);
+	}
+	drawnBars = bars;
+}
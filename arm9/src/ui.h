@@ -0,0 +1,33 @@
+#ifndef UI_H
+#define UI_H
+
+#include <nds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	UI_WHITE,
+	UI_GREEN,
+	UI_COLORS
+} UiColor;
+
+// after consoleInit, picks up the palettes the console uses for the colors
+void uiInit();
+// from the vblank irq, draws whatever changed since the last frame
+void uiVBlank();
+
+// writes one cell of a console's map directly, no escape parsing
+void uiPutChar(PrintConsole* console, int row, int col, char c, UiColor color);
+
+// progress bar on the bottom row of the top screen, setting it is just two
+// stores so it can be called from any loop, the drawing happens on vblank
+void uiSetProgress(u32 done, u32 total);
+void uiClearProgress();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/* catalogtest - checks the compiled in tmd catalogue against nitrofiles/
+ *
+ * The catalogue replaced reading the tmds from nitrofs at runtime, so this is
+ * what stands in for running the nitrofs code on the host: every entry has to
+ * decode to the bytes of its nitrofiles/<tid>/tmd.<version>, hash to the sha1
+ * stored with it and be found again by tid and version.
+ *
+ *   catalogtest [nitrofiles]      exits non zero if any entry doesn't match
+ */
+#include <nds.h>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#include "tmdcatalogue.h"
+#include "tmd_catalogue.h"
+
+static int failures = 0;
+
+static bool readFile(const char* path, uint8_t* out, size_t len)
+{
+	FILE* file = std::fopen(path, "rb");
+	if(!file)
+		return false;
+	bool ok = std::fread(out, 1, len, file) == len && std::fgetc(file) == EOF;
+	std::fclose(file);
+	return ok;
+}
+
+static void check(uint32_t tid, uint16_t version, const char* what, bool ok)
+{
+	if(ok)
+		return;
+	std::printf("%08x v%-5u %s FAILED\n", (unsigned)tid, (unsigned)version, what);
+	failures++;
+}
+
+int main(int argc, char** argv)
+{
+	const char* dir = argc > 1 ? argv[1] : "../nitrofiles";
+
+	for(const auto& entry : tmdCatalogue) {
+		auto decoded = decodeCatalogueTmd(entry);
+
+		char path[256];
+		std::snprintf(path, sizeof(path), "%s/%08x/tmd.%u", dir, (unsigned)entry.tid, (unsigned)entry.version);
+		uint8_t expected[TMD_SIZE];
+		bool found = readFile(path, expected, sizeof(expected));
+		check(entry.tid, entry.version, "tmd file", found);
+		if(found)
+			check(entry.tid, entry.version, "decoded tmd", std::memcmp(decoded.data(), expected, TMD_SIZE) == 0);
+
+		uint8_t digest[SHA1_LEN];
+		swiSHA1Calc(digest, decoded.data(), decoded.size());
+		auto stored = entry.digest;
+		check(entry.tid, entry.version, "sha1", std::memcmp(digest, stored.data(), SHA1_LEN) == 0);
+
+		check(entry.tid, entry.version, "lookup", findCatalogueTmd(entry.tid, entry.version) == &entry);
+		auto versions = findCatalogueTmds(CATALOGUE_TID_HIGH, entry.tid);
+		check(entry.tid, entry.version, "version list", &entry >= versions.data() && &entry < versions.data() + versions.size());
+		// only launchers are in there
+		check(entry.tid, entry.version, "other tid high", findCatalogueTmds(0x00030015, entry.tid).empty());
+	}
+
+	std::printf("%-28s %s\n", "tmd catalogue", failures ? "FAILED" : "ok");
+	std::printf("%zu tmds\n", std::size(tmdCatalogue));
+	return failures != 0;
+}
@@ -0,0 +1,163 @@
+/* cryptobench - times the software ciphers the ARM9 falls back on
+ *
+ * Each cipher runs over the same buffer for a fixed number of bytes. Any nand
+ * images passed are then decrypted whole with the keys in their no$gba footer,
+ * failing if sector 0 doesn't come out as an mbr.
+ *
+ *   cryptobench [nand.bin...]
+ */
+#include <nds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crypto.h"
+#include "sector0.h"
+#include "twltool/dsi.h"
+
+#define BUFFER_SECTORS     64
+#define BUFFER_SIZE        (BUFFER_SECTORS * SECTOR_SIZE)
+
+#define CRYPT_BYTES        (64 * 1024 * 1024)
+#define CCM_BYTES          (16 * 1024 * 1024)
+#define SHA1_BYTES         (64 * 1024 * 1024)
+// the es blocks tmds and tickets are sealed in are small
+#define CCM_BLOCK_SIZE     0x400
+
+#define FOOTER_MAGIC       "DSi eMMC CID/CPU"
+#define FOOTER_SIZE        0x40
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *test, u32 transfer, u64 bytes, double start)
+{
+	double seconds = now() - start;
+	printf("%-16s%6lu %9.2f MB/s\n", test, (unsigned long)transfer, seconds > 0 ? bytes / seconds / (1024 * 1024) : 0);
+}
+
+static void benchAes(u8 *buffer)
+{
+	aes_context aes;
+	static const u8 key[16] = { 0 };
+	aes_setkey_enc(&aes, key, 128);
+
+	double start = now();
+	for (u32 done = 0; done < CRYPT_BYTES; done += BUFFER_SIZE)
+	{
+		for (u32 i = 0; i < BUFFER_SIZE; i += AES_BLOCK_SIZE)
+			aes_crypt_ecb(&aes, AES_ENCRYPT, buffer + i, buffer + i);
+	}
+	report("aes ecb", BUFFER_SECTORS, CRYPT_BYTES, start);
+}
+
+static void benchNandCrypt(u8 *buffer)
+{
+	double start = now();
+	for (u32 done = 0; done < CRYPT_BYTES; done += BUFFER_SIZE)
+		dsi_nand_crypt(buffer, buffer, done / AES_BLOCK_SIZE, BUFFER_SIZE / AES_BLOCK_SIZE);
+	report("nand ctr", BUFFER_SECTORS, CRYPT_BYTES, start);
+}
+
+static void benchEsCcm(u8 *buffer)
+{
+	double start = now();
+	for (u32 done = 0; done < CCM_BYTES; done += CCM_BLOCK_SIZE)
+		dsi_es_block_crypt(buffer, CCM_BLOCK_SIZE + 0x20, ENCRYPT);
+	report("es ccm seal", CCM_BLOCK_SIZE / SECTOR_SIZE, CCM_BYTES, start);
+
+	// opening works in place, so each round opens a fresh copy of one sealed block
+	u8 sealed[CCM_BLOCK_SIZE + 0x20];
+	memcpy(sealed, buffer, sizeof(sealed));
+	start = now();
+	for (u32 done = 0; done < CCM_BYTES; done += CCM_BLOCK_SIZE)
+	{
+		memcpy(buffer, sealed, sizeof(sealed));
+		if (dsi_es_block_crypt(buffer, sizeof(sealed), DECRYPT) != 0)
+		{
+			printf("%-16sfailed\n", "es ccm open");
+			return;
+		}
+	}
+	report("es ccm open", CCM_BLOCK_SIZE / SECTOR_SIZE, CCM_BYTES, start);
+}
+
+static void benchSha1(u8 *buffer)
+{
+	u8 digest[SHA1_LEN];
+	double start = now();
+	for (u32 done = 0; done < SHA1_BYTES; done += BUFFER_SIZE)
+		swiSHA1Calc(digest, buffer, BUFFER_SIZE);
+	report("sha1", BUFFER_SECTORS, SHA1_BYTES, start);
+}
+
+static bool benchImage(const char *path, u8 *buffer)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		perror(path);
+		return false;
+	}
+
+	u8 footer[FOOTER_SIZE];
+	long size = fseek(file, -FOOTER_SIZE, SEEK_END) == 0 ? ftell(file) : -1;
+	if (size < SECTOR_SIZE || fread(footer, 1, FOOTER_SIZE, file) != FOOTER_SIZE
+		|| memcmp(footer, FOOTER_MAGIC, 16) != 0)
+	{
+		fprintf(stderr, "%s: no no$gba footer\n", path);
+		fclose(file);
+		return false;
+	}
+	u8 consoleId[8];
+	// stored as the hardware reports it, little endian
+	for (int i = 0; i < 8; i++)
+		consoleId[i] = footer[0x20 + 7 - i];
+	dsi_crypt_init(consoleId, footer + 0x10, 0);
+
+	rewind(file);
+	bool mbr = false;
+	u64 done = 0;
+	double start = now();
+	while (done < (u64)size)
+	{
+		size_t len = size - done < BUFFER_SIZE ? size - done : BUFFER_SIZE;
+		len -= len % SECTOR_SIZE;
+		if (len == 0 || fread(buffer, 1, len, file) != len)
+			break;
+		dsi_nand_crypt(buffer, buffer, done / AES_BLOCK_SIZE, len / AES_BLOCK_SIZE);
+		if (done == 0)
+			mbr = parse_mbr(buffer, 0) == 0;
+		done += len;
+	}
+	report("image decrypt", BUFFER_SECTORS, done, start);
+	fclose(file);
+
+	if (!mbr)
+		fprintf(stderr, "%s: sector 0 isn't an mbr, wrong keys?\n", path);
+	return mbr;
+}
+
+int main(int argc, char **argv)
+{
+	static u8 buffer[BUFFER_SIZE] __attribute__((aligned(32)));
+	memset(buffer, 0xA5, sizeof(buffer));
+
+	static const u8 cid[16] = { 0 };
+	static const u8 consoleId[8] = { 0 };
+	dsi_crypt_init(consoleId, cid, 0);
+
+	benchAes(buffer);
+	benchNandCrypt(buffer);
+	benchEsCcm(buffer);
+	benchSha1(buffer);
+
+	bool ok = true;
+	for (int i = 1; i < argc; i++)
+		ok = benchImage(argv[i], buffer) && ok;
+	return ok ? 0 : 1;
+}
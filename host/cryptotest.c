@@ -0,0 +1,210 @@
+/* cryptotest - known answer tests for the nand ctr and es ccm code
+ *
+ * The expected bytes were worked out independently of this code, with
+ * openssl's aes-128-ecb doing the block cipher and the dsi byte order and key
+ * scrambler applied by hand. The keys are those of the test console
+ * (cid 03 14 25 .., console id 08a1522617110136), the same as the images
+ * nandtool is tried on.
+ *
+ *   cryptotest      exits non zero if any vector doesn't match
+ */
+#include <nds.h>
+#include <stdio.h>
+
+#include "crypto.h"
+#include "f_xy.h"
+#include "sector0.h"
+#include "twltool/dsi.h"
+
+static const u8 testCid[16] = {
+	0x03, 0x14, 0x25, 0x36, 0x47, 0x58, 0x69, 0x7a,
+	0x8b, 0x9c, 0xad, 0xbe, 0xcf, 0xe0, 0xf1, 0x02,
+};
+// big endian, as dsi_crypt_init takes it
+static const u8 testConsoleId[8] = { 0x08, 0xa1, 0x52, 0x26, 0x17, 0x11, 0x01, 0x36 };
+
+// nand key and es normal key of the test console
+static const u8 nandKey[16] = {
+	0xe0, 0xc7, 0x35, 0x01, 0xa4, 0xe7, 0x6e, 0xe0,
+	0xdf, 0x08, 0xf1, 0x6a, 0xe4, 0xfa, 0xc5, 0xc3,
+};
+
+static const u8 esKey[16] = {
+	0x16, 0x75, 0x39, 0x98, 0xf8, 0xa2, 0x2c, 0xa8,
+	0x7e, 0xdf, 0x7d, 0xc7, 0x8c, 0x81, 0x44, 0x78,
+};
+
+// sector 0 holding only the 55 aa signature, its first two and last block
+static const u8 sector0Head[32] = {
+	0xce, 0x25, 0x35, 0xc3, 0xb0, 0x75, 0x18, 0xdb,
+	0xea, 0xe2, 0xca, 0xf7, 0xe9, 0x85, 0x5d, 0xb7,
+	0x3b, 0x36, 0x8a, 0xd8, 0xe5, 0xd8, 0xd3, 0xe7,
+	0xa8, 0x79, 0xde, 0x46, 0x7f, 0x03, 0x8b, 0x8f,
+};
+
+static const u8 sector0Tail[16] = {
+	0xf3, 0xa8, 0xaf, 0xe2, 0x4f, 0xc4, 0x18, 0xba,
+	0xd0, 0xb0, 0xdb, 0x67, 0xd9, 0x9d, 0x45, 0x24,
+};
+
+// two zero blocks at the start of the first partition, sector 0x877
+static const u8 partitionStart[32] = {
+	0x27, 0x06, 0x7d, 0x3a, 0xb4, 0x29, 0xa1, 0x7d,
+	0xe2, 0xe6, 0x6a, 0x47, 0x21, 0x9b, 0xea, 0x85,
+	0x05, 0x73, 0x2b, 0xe1, 0x68, 0xd5, 0xdd, 0xf3,
+	0x6c, 0x4d, 0x3d, 0x2c, 0xef, 0x0c, 0xb6, 0xf1,
+};
+
+// 00..0f as the key, 0123456789abcdef_ffffffff_fffffffe as the counter,
+// so the third block carries into the upper words, 40..7f as the data
+static const u8 ctrKey[16] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+
+static const u8 ctrOut[64] = {
+	0xfa, 0x88, 0x80, 0xa8, 0x4d, 0x4c, 0x5c, 0xa6,
+	0x1e, 0xdc, 0x48, 0x7b, 0xd3, 0x68, 0xf2, 0x9d,
+	0x92, 0xaa, 0x64, 0x42, 0x0e, 0x3a, 0x49, 0x6e,
+	0x6f, 0x23, 0x20, 0x7f, 0x17, 0x2e, 0xf8, 0xee,
+	0x72, 0x68, 0xe0, 0x30, 0x05, 0x06, 0x00, 0x55,
+	0x9b, 0xed, 0xf1, 0xc0, 0xa4, 0x28, 0x37, 0xe6,
+	0xcb, 0x73, 0xe4, 0xc7, 0x36, 0xab, 0x82, 0x28,
+	0xb6, 0xfc, 0xde, 0xc3, 0xab, 0x3f, 0xa6, 0x5f,
+};
+
+// es block of 00..3f with nonce a0..ab, sealed with the es key
+static const u8 ccmCipher[64] = {
+	0x5f, 0x42, 0x1c, 0x1e, 0xad, 0xda, 0xa9, 0x9d,
+	0x6e, 0x64, 0xc9, 0xee, 0xe8, 0x7c, 0xaa, 0x9a,
+	0x81, 0x30, 0x99, 0x5d, 0x15, 0xea, 0x17, 0x97,
+	0xb1, 0x59, 0x96, 0x2d, 0x19, 0xe8, 0xdb, 0x53,
+	0x67, 0x75, 0x6a, 0xe2, 0x6f, 0x13, 0xf0, 0xcb,
+	0x45, 0x7c, 0xfa, 0xf2, 0x76, 0x4e, 0xff, 0x07,
+	0xcc, 0x49, 0x30, 0x62, 0x3d, 0xdf, 0x03, 0x82,
+	0x43, 0xab, 0xc9, 0x17, 0xc4, 0xac, 0x76, 0xf9,
+};
+
+static const u8 ccmMeta[32] = {
+	0x5f, 0x39, 0xcf, 0x4e, 0x80, 0x53, 0xaa, 0x1d,
+	0xba, 0x24, 0x33, 0x75, 0x5d, 0xd7, 0xf1, 0x8f,
+	0x9a, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6,
+	0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xf6, 0x21, 0xfc,
+};
+
+static int failures = 0;
+
+static void check(const char *name, const void *got, const void *expected, size_t len)
+{
+	bool ok = memcmp(got, expected, len) == 0;
+	printf("%-28s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		failures++;
+}
+
+static void testKeys(void)
+{
+	u32 consoleId[2];
+	GET_UINT32_BE(consoleId[0], testConsoleId, 4);
+	GET_UINT32_BE(consoleId[1], testConsoleId, 0);
+
+	u32 keyX[4] = { consoleId[0], consoleId[0] ^ KEYSEED_DSI_NAND_0, consoleId[1] ^ KEYSEED_DSI_NAND_1, consoleId[1] };
+	u8 key[16];
+	F_XY(key, (const u8*)keyX, DSi_NAND_KEY_Y);
+	check("f_xy nand key", key, nandKey, sizeof(nandKey));
+
+	u32 esKeyX[4] = { KEYSEED_ES_0, KEYSEED_ES_1, consoleId[1] ^ KEYSEED_ES_2, consoleId[0] };
+	F_XY(key, (const u8*)esKeyX, DSi_ES_KEY_Y);
+	check("f_xy es key", key, esKey, sizeof(esKey));
+}
+
+static void testNandCrypt(void)
+{
+	static u8 sector[SECTOR_SIZE] __attribute__((aligned(32)));
+	memset(sector, 0, sizeof(sector));
+	sector[0x1FE] = 0x55;
+	sector[0x1FF] = 0xAA;
+
+	dsi_crypt_init(testConsoleId, testCid, 0);
+	dsi_nand_crypt(sector, sector, 0, SECTOR_SIZE / AES_BLOCK_SIZE);
+	check("nand sector 0 head", sector, sector0Head, sizeof(sector0Head));
+	check("nand sector 0 tail", sector + SECTOR_SIZE - sizeof(sector0Tail), sector0Tail, sizeof(sector0Tail));
+
+	// and back again
+	dsi_nand_crypt(sector, sector, 0, SECTOR_SIZE / AES_BLOCK_SIZE);
+	check("nand sector 0 round trip", sector + SECTOR_SIZE - 2, "\x55\xAA", 2);
+
+	u8 blocks[32] __attribute__((aligned(4))) = { 0 };
+	dsi_nand_crypt(blocks, blocks, 0x877 * SECTOR_SIZE / AES_BLOCK_SIZE, 2);
+	check("nand partition start", blocks, partitionStart, sizeof(partitionStart));
+}
+
+static void testCtrBlocks(void)
+{
+	dsi_context ctx;
+	dsi_set_key(&ctx, ctrKey);
+
+	u8 in[sizeof(ctrOut) + 1] __attribute__((aligned(4)));
+	u8 out[sizeof(ctrOut) + 1] __attribute__((aligned(4)));
+	for (size_t i = 0; i < sizeof(ctrOut); i++)
+		in[i] = 0x40 + i;
+
+	// w[0] holds the least significant word
+	dsi_ctr ctr = { { 0xFFFFFFFE, 0xFFFFFFFF, 0x89ABCDEF, 0x01234567 } };
+	dsi_crypt_ctr_blocks(&ctx, &ctr, in, out, sizeof(ctrOut) / AES_BLOCK_SIZE);
+	check("ctr blocks", out, ctrOut, sizeof(ctrOut));
+
+	// the byte wise path for buffers that aren't word aligned
+	memmove(in + 1, in, sizeof(ctrOut));
+	ctr = (dsi_ctr){ { 0xFFFFFFFE, 0xFFFFFFFF, 0x89ABCDEF, 0x01234567 } };
+	dsi_crypt_ctr_blocks(&ctx, &ctr, in + 1, out + 1, sizeof(ctrOut) / AES_BLOCK_SIZE);
+	check("ctr blocks unaligned", out + 1, ctrOut, sizeof(ctrOut));
+
+	static const dsi_ctr carried = { { 0x00000002, 0x00000000, 0x89ABCDF0, 0x01234567 } };
+	check("ctr carry", &ctr, &carried, sizeof(carried));
+}
+
+static void testEsCcm(void)
+{
+	u8 nonce[12];
+	for (int i = 0; i < 12; i++)
+		nonce[i] = 0xA0 + i;
+
+	u8 block[sizeof(ccmCipher) + sizeof(ccmMeta)] __attribute__((aligned(32)));
+	for (size_t i = 0; i < sizeof(ccmCipher); i++)
+		block[i] = i;
+
+	dsi_es_context ctx;
+	dsi_es_init(&ctx, (u8*)esKey);
+	dsi_es_set_nonce(&ctx, nonce);
+	dsi_es_encrypt(&ctx, block, block + sizeof(ccmCipher), sizeof(ccmCipher));
+	check("es ccm payload", block, ccmCipher, sizeof(ccmCipher));
+	check("es ccm metablock", block + sizeof(ccmCipher), ccmMeta, sizeof(ccmMeta));
+
+	// opened again through crypto.c, with the key it derives itself
+	dsi_crypt_init(testConsoleId, testCid, 0);
+	int result = dsi_es_block_crypt(block, sizeof(block), DECRYPT);
+	u8 pattern[sizeof(ccmCipher)];
+	for (size_t i = 0; i < sizeof(pattern); i++)
+		pattern[i] = i;
+	check("es ccm open", &result, &(int){ 0 }, sizeof(result));
+	check("es ccm plaintext", block, pattern, sizeof(pattern));
+
+	// a flipped payload bit has to fail the mac
+	memcpy(block, ccmCipher, sizeof(ccmCipher));
+	memcpy(block + sizeof(ccmCipher), ccmMeta, sizeof(ccmMeta));
+	block[5] ^= 1;
+	result = dsi_es_block_crypt(block, sizeof(block), DECRYPT) != 0;
+	check("es ccm tampered", &result, &(int){ 1 }, sizeof(result));
+}
+
+int main(void)
+{
+	testKeys();
+	testNandCrypt();
+	testCtrBlocks();
+	testEsCcm();
+	if (failures)
+		printf("%d failed\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,25 @@
+/* host stand-in for libnds' nds.h, the hardware bits are no-ops */
+#pragma once
+
+#include <nds/ndstypes.h>
+#include <nds/fifocommon.h>
+#include <nds/sha1.h>
+#include <nds/disc_io.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// host memory is coherent
+static inline void DC_FlushRange(const void *base, u32 size) { (void)base; (void)size; }
+static inline void DC_InvalidateRange(const void *base, u32 size) { (void)base; (void)size; }
+static inline void DC_FlushAll(void) {}
+static inline void *memUncached(void *address) { return address; }
+static inline void *memCached(void *address) { return address; }
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,26 @@
+/* host stand-in for libnds' fifocommon.h, nothing answers on the other end */
+#pragma once
+
+#include <nds/ndstypes.h>
+
+#define FIFO_USER_01 8
+#define FIFO_USER_02 9
+#define FIFO_USER_03 10
+#define FIFO_USER_04 11
+#define FIFO_USER_05 12
+#define FIFO_USER_06 13
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool fifoSendDatamsg(int channel, int num_bytes, u8 *data_array);
+bool fifoSendAddress(int channel, void *address);
+bool fifoSendValue32(int channel, u32 value32);
+bool fifoCheckValue32(int channel);
+u32 fifoGetValue32(int channel);
+void fifoWaitValue32(int channel);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,30 @@
+/* host stand-in for libnds' ndstypes.h, only what the shared sources use */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef volatile u8 vu8;
+typedef volatile u16 vu16;
+typedef volatile u32 vu32;
+typedef volatile uint16_t vuint16;
+typedef volatile uint32_t vuint32;
+
+typedef uint32_t sec_t;
+
+#define BIT(n) (1u << (n))
+
+// no tcm on the host, keep everything in plain sections
+#define ITCM_CODE
+#define DTCM_DATA
+#define DTCM_BSS
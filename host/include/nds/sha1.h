@@ -0,0 +1,25 @@
+/* host stand-in for libnds' sha1.h, backed by a portable implementation */
+#pragma once
+
+#include <nds/ndstypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct swiSHA1context {
+	u32 state[5];
+	u32 total[2];
+	u8 buffer[64];
+	u32 fragment_size;
+	void (*sha_block)(struct swiSHA1context *ctx, const void *src, size_t len);
+} swiSHA1context_t;
+
+void swiSHA1Init(swiSHA1context_t *ctx);
+void swiSHA1Update(swiSHA1context_t *ctx, const void *data, size_t len);
+void swiSHA1Final(void *digest, swiSHA1context_t *ctx);
+void swiSHA1Calc(void *digest, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
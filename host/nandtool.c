@@ -0,0 +1,388 @@
+/* nandtool - checks and restores the launcher tmd of DSi nand dumps offline
+ *
+ * Every image is mapped and only the sectors the fat walk needs get decrypted,
+ * through the same crypto and fatraw code the ARM9 uses. The core keeps its
+ * keys in globals, so images are worked on in forked processes, -j at a time.
+ *
+ *   nandtool [-n] [-j jobs] [-c nitrofiles] [--cid hex --console-id hex] nand.bin...
+ *
+ * The keys come from the no$gba footer when the dump has one, otherwise from
+ * --cid (in footer byte order) and --console-id (as printed, big endian).
+ */
+#include <nds.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "crypto.h"
+#include "fatraw.h"
+#include "sector0.h"
+
+#define FOOTER_MAGIC        "DSi eMMC CID/CPU"
+#define FOOTER_SIZE         0x40
+
+#define TMD_SIZE            520
+#define TMD_MAX_SIZE        0x10000
+#define HWINFO_TID_OFFSET   0xA0
+
+enum {
+	RESULT_OK,
+	RESULT_PATCHED,
+	RESULT_MISMATCH, // only with -n
+	RESULT_ERROR,
+};
+
+static bool dryRun = false;
+static const char *catalogueDir = "nitrofiles";
+static bool haveKeys = false;
+static u8 optionCid[16];
+static u8 optionConsoleId[8];
+
+static u8 *image = NULL;
+static size_t imageSectors = 0;
+
+static bool imageRead(sec_t sector, sec_t numSectors, void *buffer)
+{
+	if (sector + numSectors > imageSectors)
+		return false;
+	memcpy(buffer, image + (size_t)sector * SECTOR_SIZE, numSectors * SECTOR_SIZE);
+	dsi_nand_crypt(buffer, buffer, sector * SECTOR_SIZE / AES_BLOCK_SIZE, numSectors * SECTOR_SIZE / AES_BLOCK_SIZE);
+	return true;
+}
+
+static bool imageWrite(sec_t sector, sec_t numSectors, const void *buffer)
+{
+	if (dryRun || sector + numSectors > imageSectors)
+		return false;
+	u8 *dst = image + (size_t)sector * SECTOR_SIZE;
+	memcpy(dst, buffer, numSectors * SECTOR_SIZE);
+	dsi_nand_crypt(dst, dst, sector * SECTOR_SIZE / AES_BLOCK_SIZE, numSectors * SECTOR_SIZE / AES_BLOCK_SIZE);
+	return true;
+}
+
+static bool imageNop(void)
+{
+	return true;
+}
+
+static const DISC_INTERFACE imageDisc = {
+	0x4E414E44, // 'NAND'
+	FEATURE_MEDIUM_CANREAD | FEATURE_MEDIUM_CANWRITE,
+	imageNop,
+	imageNop,
+	imageRead,
+	imageWrite,
+	imageNop,
+	imageNop,
+};
+
+static bool parseHex(const char *str, u8 *out, size_t len)
+{
+	if (strlen(str) != len * 2)
+		return false;
+	for (size_t i = 0; i < len; i++)
+	{
+		unsigned value;
+		if (!isxdigit((unsigned char)str[i * 2]) || !isxdigit((unsigned char)str[i * 2 + 1])
+			|| sscanf(str + i * 2, "%2x", &value) != 1)
+			return false;
+		out[i] = value;
+	}
+	return true;
+}
+
+// reads up to max bytes of a file through its cluster chain, -1 if it's missing
+typedef struct {
+	u8 *out;
+	u32 max;
+	u32 done;
+} read_state;
+
+static bool readRun(sec_t start, sec_t len, u32 bytes, void *user)
+{
+	read_state *state = (read_state *)user;
+	static u8 sector[SECTOR_SIZE] __attribute__((aligned(32)));
+	for (sec_t i = 0; i < len && state->done < state->max; i++)
+	{
+		if (!imageRead(start + i, 1, sector))
+			return false;
+		u32 chunk = bytes - i * SECTOR_SIZE < SECTOR_SIZE ? bytes - i * SECTOR_SIZE : SECTOR_SIZE;
+		if (chunk > state->max - state->done)
+			chunk = state->max - state->done;
+		memcpy(state->out + state->done, sector, chunk);
+		state->done += chunk;
+	}
+	return true;
+}
+
+static long readNandFile(const char *path, u8 *out, u32 max)
+{
+	read_state state = { out, max, 0 };
+	if (!fatraw_file_runs(path, readRun, &state, NULL))
+		return -1;
+	return state.done;
+}
+
+// fatraw only writes the first fat, its touched sectors in there are copied to
+// the others once the patch went through, or all of it if the list ran over
+static bool syncFatCopies(void)
+{
+	const fatraw_geometry *fat = fatraw_get_geometry();
+	const sec_t *touched;
+	u32 count = fatraw_touched_sectors(&touched);
+	static u8 sector[SECTOR_SIZE] __attribute__((aligned(32)));
+	u32 total = count > FATRAW_MAX_TOUCHED ? fat->sectorsPerFat : count;
+	for (u32 i = 0; i < total; i++)
+	{
+		sec_t source = count > FATRAW_MAX_TOUCHED ? fat->fatStart + i : touched[i];
+		if (source < fat->fatStart || source >= fat->fatStart + fat->sectorsPerFat)
+			continue;
+		if (!imageRead(source, 1, sector))
+			return false;
+		for (u32 copy = 1; copy < fat->numFats; copy++)
+		{
+			if (!imageWrite(source + copy * fat->sectorsPerFat, 1, sector))
+				return false;
+		}
+	}
+	return true;
+}
+
+// keeps the lowest v of the 0000000v.app files in a content directory
+static bool lowestApp(const char shortName[11], u8 attr, u32 size, void *user)
+{
+	int *version = (int *)user;
+	if ((attr & FATRAW_ATTR_DIRECTORY) == 0 && memcmp(shortName, "0000000", 7) == 0
+		&& shortName[7] >= '0' && shortName[7] <= '7' && memcmp(shortName + 8, "APP", 3) == 0
+		&& (*version < 0 || shortName[7] - '0' < *version))
+		*version = shortName[7] - '0';
+	return true;
+}
+
+static bool readCatalogueTmd(u32 tid, u32 version, u8 *tmd)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%08x/tmd.%u", catalogueDir, tid, version);
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+	size_t got = fread(tmd, 1, TMD_SIZE + 1, file);
+	fclose(file);
+	if (got != TMD_SIZE)
+		return false;
+
+	// same check the table generator does
+	char expected[SHA1_LEN * 2 + 1] = {0};
+	strncat(path, ".sha1", sizeof(path) - strlen(path) - 1);
+	file = fopen(path, "rb");
+	if (!file)
+		return false;
+	got = fread(expected, 1, SHA1_LEN * 2, file);
+	fclose(file);
+
+	u8 digest[SHA1_LEN];
+	u8 expectedDigest[SHA1_LEN];
+	swiSHA1Calc(digest, tmd, TMD_SIZE);
+	return got == SHA1_LEN * 2 && parseHex(expected, expectedDigest, SHA1_LEN)
+		&& memcmp(digest, expectedDigest, SHA1_LEN) == 0;
+}
+
+static int report(const char *imagePath, int result, const char *message)
+{
+	static const char *const names[] = { "ok", "patched", "mismatch", "error" };
+	printf("%s: %s%s%s\n", imagePath, names[result], message ? ": " : "", message ? message : "");
+	fflush(stdout);
+	return result;
+}
+
+static int processMapped(const char *imagePath, size_t size)
+{
+	u8 cid[16];
+	u8 consoleId[8];
+
+	if (size > FOOTER_SIZE && memcmp(image + size - FOOTER_SIZE, FOOTER_MAGIC, 16) == 0)
+	{
+		const u8 *footer = image + size - FOOTER_SIZE;
+		memcpy(cid, footer + 0x10, 16);
+		// stored as the hardware reports it, little endian
+		for (int i = 0; i < 8; i++)
+			consoleId[i] = footer[0x20 + 7 - i];
+	}
+	else if (haveKeys)
+	{
+		memcpy(cid, optionCid, 16);
+		memcpy(consoleId, optionConsoleId, 8);
+	}
+	else
+	{
+		return report(imagePath, RESULT_ERROR, "no footer, pass --cid and --console-id");
+	}
+	imageSectors = size / SECTOR_SIZE;
+
+	dsi_crypt_init(consoleId, cid, 0);
+
+	static u8 sector0[SECTOR_SIZE] __attribute__((aligned(32)));
+	if (!imageRead(0, 1, sector0) || parse_mbr(sector0, 0) != 0)
+		return report(imagePath, RESULT_ERROR, "bad mbr, wrong keys?");
+	if (!fatraw_init(&imageDisc))
+		return report(imagePath, RESULT_ERROR, "no fat partition");
+
+	u8 hwinfo[HWINFO_TID_OFFSET + 4];
+	if (readNandFile("sys/HWINFO_S.dat", hwinfo, sizeof(hwinfo)) != sizeof(hwinfo))
+		return report(imagePath, RESULT_ERROR, "can't read HWINFO_S.dat");
+	u32 tid = hwinfo[HWINFO_TID_OFFSET] | (hwinfo[HWINFO_TID_OFFSET + 1] << 8)
+		| (hwinfo[HWINFO_TID_OFFSET + 2] << 16) | ((u32)hwinfo[HWINFO_TID_OFFSET + 3] << 24);
+
+	// the launcher's app is 0000000v.app, its tmd is version v * 256
+	char contentPath[64];
+	char appPath[96];
+	snprintf(contentPath, sizeof(contentPath), "title/00030017/%08x/content", tid);
+	int appVersion = -1;
+	if (!fatraw_list_dir(contentPath, lowestApp, &appVersion) || appVersion < 0)
+		return report(imagePath, RESULT_ERROR, "launcher app not found");
+	snprintf(appPath, sizeof(appPath), "%s/0000000%d.app", contentPath, appVersion);
+
+	u8 expected[TMD_SIZE];
+	if (!readCatalogueTmd(tid, appVersion * 256, expected))
+	{
+		char message[64];
+		snprintf(message, sizeof(message), "no catalogue tmd for %08x v%d", tid, appVersion * 256);
+		return report(imagePath, RESULT_ERROR, message);
+	}
+
+	char tmdPath[96];
+	snprintf(tmdPath, sizeof(tmdPath), "%s/title.tmd", contentPath);
+	u8 *current = malloc(TMD_MAX_SIZE + 1);
+	long currentSize = current ? readNandFile(tmdPath, current, TMD_MAX_SIZE + 1) : -1;
+	bool matches = currentSize == TMD_SIZE && memcmp(current, expected, TMD_SIZE) == 0;
+	free(current);
+	if (matches)
+		return report(imagePath, RESULT_OK, NULL);
+	if (dryRun)
+		return report(imagePath, RESULT_MISMATCH, NULL);
+
+	fatraw_rewrite_result rewrite = currentSize < 0 ? FATRAW_REWRITE_UNSUPPORTED : fatraw_rewrite_file(tmdPath, expected, TMD_SIZE);
+	if (rewrite == FATRAW_REWRITE_UNSUPPORTED)
+		return report(imagePath, RESULT_ERROR, "tmd can't be rewritten in place");
+	if (rewrite == FATRAW_REWRITE_FAILED)
+		return report(imagePath, RESULT_ERROR, "write failed partway, the image is damaged");
+	if (!syncFatCopies())
+		return report(imagePath, RESULT_ERROR, "failed to copy the fat");
+	if (!fatraw_set_attributes(appPath, 0, FATRAW_ATTR_READONLY))
+		return report(imagePath, RESULT_ERROR, "failed to mark the launcher app writable");
+	return report(imagePath, RESULT_PATCHED, NULL);
+}
+
+static int processImage(const char *imagePath)
+{
+	int fd = open(imagePath, dryRun ? O_RDONLY : O_RDWR);
+	if (fd < 0)
+		return report(imagePath, RESULT_ERROR, strerror(errno));
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < SECTOR_SIZE)
+	{
+		close(fd);
+		return report(imagePath, RESULT_ERROR, "not a nand image");
+	}
+
+	image = mmap(NULL, st.st_size, dryRun ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return report(imagePath, RESULT_ERROR, strerror(errno));
+
+	int result = processMapped(imagePath, st.st_size);
+
+	if (result == RESULT_PATCHED && msync(image, st.st_size, MS_SYNC) != 0)
+		result = report(imagePath, RESULT_ERROR, strerror(errno));
+	munmap(image, st.st_size);
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n] [-j jobs] [-c nitrofiles] [--cid hex --console-id hex] nand.bin...\n"
+					"  -n  only check, don't patch\n"
+					"  -j  images to work on at once, defaults to the number of cores\n"
+					"  -c  catalogue directory, defaults to nitrofiles\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "cid", required_argument, NULL, 'C' },
+		{ "console-id", required_argument, NULL, 'I' },
+		{ NULL, 0, NULL, 0 },
+	};
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	bool haveCid = false, haveConsoleId = false;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "nj:c:", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				dryRun = true;
+				break;
+			case 'j':
+				jobs = strtol(optarg, NULL, 10);
+				break;
+			case 'c':
+				catalogueDir = optarg;
+				break;
+			case 'C':
+				haveCid = parseHex(optarg, optionCid, sizeof(optionCid));
+				break;
+			case 'I':
+				haveConsoleId = parseHex(optarg, optionConsoleId, sizeof(optionConsoleId));
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if (optind == argc || jobs < 1)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	haveKeys = haveCid && haveConsoleId;
+
+	int failures = 0;
+	long running = 0;
+	for (int i = optind; i < argc || running > 0;)
+	{
+		if (i < argc && running < jobs)
+		{
+			pid_t pid = fork();
+			if (pid == 0)
+				_exit(processImage(argv[i]));
+			if (pid < 0)
+			{
+				perror("fork");
+				failures++;
+			}
+			else
+			{
+				running++;
+			}
+			i++;
+			continue;
+		}
+
+		int status;
+		if (wait(&status) < 0)
+			break;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) >= RESULT_MISMATCH)
+			failures++;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+/* there's no arm7 on the host, every request fails so the callers stay on
+ * their software paths */
+#include <nds/fifocommon.h>
+
+bool fifoSendDatamsg(int channel, int num_bytes, u8 *data_array)
+{
+	(void)channel; (void)num_bytes; (void)data_array;
+	return false;
+}
+
+bool fifoSendAddress(int channel, void *address)
+{
+	(void)channel; (void)address;
+	return false;
+}
+
+bool fifoSendValue32(int channel, u32 value32)
+{
+	(void)channel; (void)value32;
+	return false;
+}
+
+bool fifoCheckValue32(int channel)
+{
+	(void)channel;
+	return false;
+}
+
+u32 fifoGetValue32(int channel)
+{
+	(void)channel;
+	return 0;
+}
+
+void fifoWaitValue32(int channel)
+{
+	(void)channel;
+}
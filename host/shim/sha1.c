@@ -0,0 +1,113 @@
+/* portable sha1 behind the swiSHA1 calls, the DSi does this in its bios */
+#include <nds/sha1.h>
+#include <string.h>
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(swiSHA1context_t *ctx, const u8 *block)
+{
+	u32 w[80];
+	for (int i = 0; i < 16; i++)
+		w[i] = ((u32)block[i * 4] << 24) | ((u32)block[i * 4 + 1] << 16) | ((u32)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	for (int i = 16; i < 80; i++)
+		w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	u32 a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3], e = ctx->state[4];
+	for (int i = 0; i < 80; i++)
+	{
+		u32 f, k;
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		u32 t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+}
+
+void swiSHA1Init(swiSHA1context_t *ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xEFCDAB89;
+	ctx->state[2] = 0x98BADCFE;
+	ctx->state[3] = 0x10325476;
+	ctx->state[4] = 0xC3D2E1F0;
+	ctx->total[0] = ctx->total[1] = 0;
+	ctx->fragment_size = 0;
+}
+
+void swiSHA1Update(swiSHA1context_t *ctx, const void *data, size_t len)
+{
+	const u8 *in = (const u8*)data;
+	u64 total = ((u64)ctx->total[1] << 32 | ctx->total[0]) + len;
+	ctx->total[0] = (u32)total;
+	ctx->total[1] = (u32)(total >> 32);
+
+	while (len > 0)
+	{
+		size_t take = 64 - ctx->fragment_size;
+		if (take > len)
+			take = len;
+		memcpy(ctx->buffer + ctx->fragment_size, in, take);
+		ctx->fragment_size += take;
+		in += take;
+		len -= take;
+		if (ctx->fragment_size == 64)
+		{
+			sha1_block(ctx, ctx->buffer);
+			ctx->fragment_size = 0;
+		}
+	}
+}
+
+void swiSHA1Final(void *digest, swiSHA1context_t *ctx)
+{
+	u64 bits = ((u64)ctx->total[1] << 32 | ctx->total[0]) * 8;
+	u8 pad[72] = { 0x80 };
+	size_t padLen = (ctx->fragment_size < 56 ? 56 : 120) - ctx->fragment_size;
+	for (int i = 0; i < 8; i++)
+		pad[padLen + i] = (u8)(bits >> (56 - i * 8));
+	swiSHA1Update(ctx, pad, padLen + 8);
+
+	u8 *out = (u8*)digest;
+	for (int i = 0; i < 5; i++)
+	{
+		out[i * 4] = ctx->state[i] >> 24;
+		out[i * 4 + 1] = ctx->state[i] >> 16;
+		out[i * 4 + 2] = ctx->state[i] >> 8;
+		out[i * 4 + 3] = ctx->state[i];
+	}
+}
+
+void swiSHA1Calc(void *digest, const void *data, size_t len)
+{
+	swiSHA1context_t ctx;
+	swiSHA1Init(&ctx);
+	swiSHA1Update(&ctx, data, len);
+	swiSHA1Final(digest, &ctx);
+}
@@ -0,0 +1,94 @@
+#!/bin/sh
+# Turns a nitrofiles/<tid>/tmd.<version> (+ .sha1) tree into a C++ header with
+# a constexpr catalogue, sorted by title id and version for binary searching.
+# The tmds are nearly identical, so only one base tmd is stored (the most
+# common value of every byte) and each entry is a list of runs against it:
+#   <bytes equal to the base> <literal bytes> <the literal bytes...>
+# with both counts a single byte, bytes after the last run come from the base.
+# usage: gen_tmd_catalogue.sh <nitrofiles dir> > tmd_catalogue.h
+
+set -e
+
+dir=${1:?usage: $0 <nitrofiles dir>}
+
+list=""
+for tiddir in $(ls -d "$dir"/*/ | sort); do
+	tid=$(basename "$tiddir")
+	for version in $(ls "$tiddir" | sed -n 's/^tmd\.\([0-9]*\)$/\1/p' | sort -n); do
+		tmd="$tiddir/tmd.$version"
+		size=$(wc -c < "$tmd")
+		if [ "$size" -ne 520 ]; then
+			echo "$tmd: expected 520 bytes, got $size" >&2
+			exit 1
+		fi
+		list="$list $tid:$version:$(head -c 40 "$tmd.sha1"):$tmd"
+	done
+done
+
+echo $list | tr ' ' '\n' | awk -F: '
+function hex(b) { return sprintf("0x%02x", b) }
+function emit(b) {
+	line = line (nline ? ", " : "\t") hex(b)
+	if (++nline == 16) { print line ","; line = ""; nline = 0 }
+}
+function flush() { if (nline) print line ","; line = ""; nline = 0 }
+{
+	tid[NR] = $1; version[NR] = $2; sha1[NR] = $3
+	cmd = "od -An -v -tu1 \"" $4 "\""
+	n = 0
+	while ((cmd | getline l) > 0) {
+		split(l, bytes, " ")
+		for (i = 1; i in bytes; i++) data[NR, n++] = bytes[i] + 0
+		delete bytes
+	}
+	close(cmd)
+}
+END {
+	count = NR
+	for (p = 0; p < 520; p++) {
+		delete freq
+		best = 0
+		for (e = 1; e <= count; e++) {
+			v = data[e, p]
+			if (++freq[v] > best) { best = freq[v]; base[p] = v }
+		}
+	}
+
+	print "// generated by tools/gen_tmd_catalogue.sh, do not edit"
+	print "// only meant to be included by tmdcatalogue.cpp, after tmdcatalogue.h"
+	print "#pragma once"
+	print ""
+	print "inline constexpr uint8_t tmdCatalogueBase[TMD_SIZE] = {"
+	for (p = 0; p < 520; p++) emit(base[p])
+	flush()
+	print "};"
+	print ""
+	print "inline constexpr uint8_t tmdCatalogueDeltas[] = {"
+	offset = 0
+	for (e = 1; e <= count; e++) {
+		start[e] = offset
+		print "\t// " tid[e] " v" version[e]
+		p = 0
+		while (p < 520) {
+			last = 519
+			while (last >= p && data[e, last] == base[last]) last--
+			if (last < p) break
+			same = 0
+			while (same < 255 && p + same < 520 && data[e, p + same] == base[p + same]) same++
+			lit = 0
+			while (lit < 255 && p + same + lit < 520 && data[e, p + same + lit] != base[p + same + lit]) lit++
+			emit(same); emit(lit)
+			for (i = 0; i < lit; i++) emit(data[e, p + same + i])
+			offset += 2 + lit
+			p += same + lit
+		}
+		flush()
+		size[e] = offset - start[e]
+	}
+	print "};"
+	print ""
+	print "inline constexpr TmdCatalogueEntry tmdCatalogue[] = {"
+	for (e = 1; e <= count; e++)
+		printf "\t{0x%s, %s, \"%s\"_sha1, %d, %d},\n", tid[e], version[e], sha1[e], start[e], size[e]
+	print "};"
+}'